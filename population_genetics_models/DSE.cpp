@@ -1,14 +1,14 @@
 #include <cassert>
 #include <string>
 #include <vector>
-#include <numeric>
-#include <random>
 #include "Parameters.h"
 #include "DSE.h"
 #include "rng.h"
 #include "conditional_existence_probability.h"
+#include "cost_model.h"
 #include "trait_invasion.h"
 #include "run_scenario.h"
+#include "run_options.h"
 
 namespace DSE {
 
@@ -19,7 +19,7 @@ namespace DSE {
      @return params parameters::DSE_Model_Parameters struct
   */
   const parameters::DSE_Model_Parameters parse_parameter_values(int argc, char* argv[]){
-    assert(std::string(argv[1]).compare("DSE"));
+    assert(std::string(argv[1]).compare("DSE") == 0);
     assert(argc == 8 && "The DSE model must have 7 command line arguments (the first must be 'DSE')");
     assert((std::string(argv[2]).compare("LSTM") == 0 || std::string(argv[2]).compare("QEF") == 0) &&
 	   "Incorrect model specification: specify whether the model type is LSTM or QEF in the second arg");
@@ -45,34 +45,6 @@ namespace DSE {
       1.0 + parameters.model.selection_coefficient_heterozygote, 1.0};
     return fitnesses;
   }
-  /**
-     @brief Calculates frequency of the trait after selection and random mating
-     @param[in, out] trait_freq The frequency of the trait
-     @param[in] fitnesses Vector containing AA, Aa, and aa genotype fitnesses [wAA, wAa, waa]
-     @param[in] parameters::DSE_Model_Parameters::Shared_Parameters::population_size Number of individuals in the population
-     @param[in, out] rng Random number generator
-     @param[in, out] gen The current generation
-     @return Nothing (but modifies \p trait_freq and increments \p gen)
-  */
-  void calculate_trait_freqs(std::vector<double> &trait_freq, const std::vector<double> &fitnesses,
-			     const parameters::DSE_Model_Parameters &parameters, std::mt19937 &rng, int &gen){
-    double allele_A_freq = trait_freq[0] + 0.5 * trait_freq[1];
-    std::vector<double> expected_genotype_freq(3);
-    expected_genotype_freq[0] = std::pow(allele_A_freq, 2.0) * fitnesses[0]; // AA
-    expected_genotype_freq[1] = 2 * allele_A_freq * (1.0 - allele_A_freq) * fitnesses[1]; // Aa
-    expected_genotype_freq[2] = std::pow((1 - allele_A_freq), 2.0) * fitnesses[2]; // aa
-    // multinomial sample to get realised outcome for trait_freq (discrete_distribution normalises probs)
-    std::discrete_distribution<int> multinom {expected_genotype_freq.begin(), expected_genotype_freq.end()};
-    // sample surviving (individuals with) traits
-    std::vector<int> surviving_traits(3);
-    for (int i = 0; i < parameters.shared.population_size; i++){
-      ++surviving_traits[ multinom(rng) ];
-    }
-    // convert counts into proportions for individuals with traits AA and Aa
-    trait_freq[0] = static_cast<double>(surviving_traits[0]) / parameters.shared.population_size;
-    trait_freq[1] = static_cast<double>(surviving_traits[1]) / parameters.shared.population_size;
-    ++gen;
-  }
 
   /**
      @brief Runs Diploid Single Environment model
@@ -81,16 +53,32 @@ namespace DSE {
      @return Nothing (but prints results)
   */
   void run_model(int argc, char* argv[]){
-    std::mt19937 rng = rng::initialise_rng();
     const parameters::DSE_Model_Parameters params = parse_parameter_values(argc, argv);
-    const std::vector<double> fitnesses = get_fitness_function(params);
+    const Kernel kernel(params, get_fitness_function(params));
+    const run_options::Run_Options &options = run_options::get();
 
-    if (std::string(argv[2]).compare("QEF") == 0){
-      run_scenario::QEF(params, rng, fitnesses, calculate_trait_freqs, argv, argc);
-    } else if (std::string(argv[2]).compare("LSTM") == 0){
-      run_scenario::LSTM(params, rng, fitnesses, calculate_trait_freqs, argv, argc);
-    }
+    rng::with_engine(options.rng_engine, options.seed, [&](auto &rng){
+      if (std::string(argv[2]).compare("QEF") == 0){
+	run_scenario::QEF(kernel, params, rng, argv, argc);
+      } else if (std::string(argv[2]).compare("LSTM") == 0){
+	run_scenario::LSTM(kernel, params, rng, argv, argc);
+      }
+    });
 
   }
+  /**
+     @brief Estimates the run time of a point of the Diploid Single Environment model (see cost_model)
+     @param[in] argc Number of command line arguments
+     @param[in] argv Array of command line arguments
+     @return Estimated time in seconds on one thread
+  */
+  double estimate_cost(int argc, char* argv[]){
+    const parameters::DSE_Model_Parameters params = parse_parameter_values(argc, argv);
+    const Kernel kernel(params, get_fitness_function(params));
+    // an LSTM point runs number_replicates_QEF replicates and records the first number_replicates_LSTM of them
+    const int number_recorded = std::string(argv[2]).compare("LSTM") == 0 ? params.fixed.number_replicates_LSTM : 0;
+    return cost_model::estimate(kernel, params, params.fixed.number_replicates_QEF, 1, run_options::get().seed,
+				number_recorded);
+  }
 
 }
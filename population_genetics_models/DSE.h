@@ -5,9 +5,11 @@
 #ifndef DSE_H
 #define DSE_H
 
+#include <array>
 #include <vector>
-#include <random>
 #include "Parameters.h"
+#include "trait_freq.h"
+#include "binomial.h"
 /**
    @brief Namespace for Diploid Single Environment
    @details This model is a Wright-Fisher diploid model (one locus, two alleles, single environment).
@@ -26,10 +28,70 @@ namespace DSE {
   
   const std::vector<double> get_fitness_function(const parameters::DSE_Model_Parameters &parameters);
 
-  void calculate_allele_freqs(std::vector<double> &trait_freq, const std::vector<double> &fitnesses,
-			      const parameters::DSE_Model_Parameters &parameters, std::mt19937 &rng, int &gen);
+  /**
+     @brief Per-generation kernel of the Diploid Single Environment model
+     @details Constants are fixed at construction (N and the genotype fitnesses). Each generation
+     the expected genotype frequencies after random mating and selection are calculated and the surviving
+     genotypes are drawn as a multinomial sample.
+  */
+  struct Kernel {
+    using Parameters = parameters::DSE_Model_Parameters;
+    static constexpr int number_environments = 1;
+    const int population_size; /**< Number of individuals in the population */
+    const double fitness_AA; /**< wAA */
+    const double fitness_Aa; /**< wAa */
+    const double fitness_aa; /**< waa */
+
+    /** @param[in] fitnesses Genotype fitnesses [wAA, wAa, waa] (from get_fitness_function) */
+    Kernel(const Parameters &parameters, const std::vector<double> &fitnesses)
+      : population_size(parameters.shared.population_size), fitness_AA(fitnesses[0]), fitness_Aa(fitnesses[1]),
+	fitness_aa(fitnesses[2]) {}
+    /**
+       @brief Unnormalised genotype frequencies [AA, Aa, aa] after random mating and selection
+       @param[in] trait_count Current {#AA, #Aa}
+    */
+    std::array<double, 3> genotype_weights(const trait_freq::trait_counts<Parameters> &trait_count) const {
+      const double allele_A_freq = (trait_count[0] + 0.5 * trait_count[1]) / population_size;
+      const double allele_a_freq = 1.0 - allele_A_freq;
+      return {allele_A_freq * allele_A_freq * fitness_AA, 2.0 * allele_A_freq * allele_a_freq * fitness_Aa,
+	allele_a_freq * allele_a_freq * fitness_aa};
+    }
+    /** @brief Environment in generation \p gen (a single environment, so always 0) */
+    int environment(const int) const {
+      return 0;
+    }
+    /** @brief Environment of every generation from \p gen on (a single environment, so always 0) */
+    int final_environment(const int) const {
+      return 0;
+    }
+    /**
+       @brief Mean and variance of the frequency of allele A in the next generation, given allele A frequency
+       \p freq (genotypes in Hardy-Weinberg proportions; the diffusion limit used by backward_equation)
+    */
+    std::array<double, 2> frequency_moments(const double freq, const int) const {
+      const double raw_AA = freq * freq * fitness_AA;
+      const double raw_Aa = 2.0 * freq * (1.0 - freq) * fitness_Aa;
+      const double raw_aa = (1.0 - freq) * (1.0 - freq) * fitness_aa;
+      const double total = raw_AA + raw_Aa + raw_aa;
+      const double mean = (raw_AA + 0.5 * raw_Aa) / total;
+      // each individual carries 2 (AA), 1 (Aa) or 0 (aa) copies of A
+      return {mean, ((raw_AA + 0.25 * raw_Aa) / total - mean * mean) / population_size};
+    }
+    /** @brief Advances \p trait_count ({#AA, #Aa}) by one generation (random mating, selection, sampling) */
+    template <class R>
+    void step(trait_freq::trait_counts<Parameters> &trait_count, R &rng, const int) const {
+      const auto [raw_AA, raw_Aa, raw_aa] = genotype_weights(trait_count);
+      // multinomial sample of surviving (individuals with) traits, drawn as conditional binomials:
+      // AA ~ Bin(N, P(AA)), then Aa ~ Bin(N - AA, P(Aa | not AA)); the remainder are aa
+      const int surviving_AA = binomial::sample(rng, population_size, raw_AA / (raw_AA + raw_Aa + raw_aa));
+      const int remaining = population_size - surviving_AA;
+      trait_count[0] = surviving_AA;
+      trait_count[1] = remaining > 0 ? binomial::sample(rng, remaining, raw_Aa / (raw_Aa + raw_aa)) : 0;
+    }
+  };
 
   void run_model(int argc, char* argv[]);
+  double estimate_cost(int argc, char* argv[]);
 
 }
 
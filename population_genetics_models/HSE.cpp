@@ -1,14 +1,14 @@
 #include <cassert>
 #include <string>
 #include <vector>
-#include <numeric>
-#include <random>
 #include "Parameters.h"
 #include "HSE.h"
 #include "rng.h"
 #include "conditional_existence_probability.h"
+#include "cost_model.h"
 #include "trait_invasion.h"
 #include "run_scenario.h"
+#include "run_options.h"
 
 namespace HSE {
   
@@ -34,40 +34,36 @@ namespace HSE {
     return fitnesses;
   }
   /**
-     @details The function first calculates the expected (deterministic) allele frequency due to selection.
-     It then uses this expectation as the probability for a (random) binomial sampling process to get a new
-     \p trait_freq. It also increments the current \p gen.
+     @details Calls HSE::parse_parameter_values() and HSE::get_fitness_function(), constructs the random number
+     engine chosen in the run options (rng::with_engine()), and runs the QEF or LSTM scenario with it.
   */
-  void calculate_trait_freqs(std::vector<double> &trait_freq, const std::vector<double> &fitnesses,
-			     const parameters::HSE_Model_Parameters &parameters, std::mt19937 &rng, int &gen){
-    std::vector<double> expected_allele_freq_raw(2);
-    expected_allele_freq_raw[0] = trait_freq[0] * fitnesses[0];
-    expected_allele_freq_raw[1] = (1.0 - trait_freq[0]) * fitnesses[1];
-    // get normalised expectation for trait_freq
-    double expectation = expected_allele_freq_raw[0] / (std::accumulate(expected_allele_freq_raw.begin(),
-									expected_allele_freq_raw.end(), 0.0));
-    // sample to get realised outcome for trait_freq
-    std::binomial_distribution<int> surviving_As(parameters.shared.population_size, expectation);
-    trait_freq[0] =
-      static_cast<double>(surviving_As(rng)) / static_cast<double>(parameters.shared.population_size);
-    ++gen;
+  void run_model(int argc, char* argv[]){
+    const parameters::HSE_Model_Parameters params = parse_parameter_values(argc, argv);
+    const Kernel kernel(params, get_fitness_function(params));
+    const run_options::Run_Options &options = run_options::get();
+
+    rng::with_engine(options.rng_engine, options.seed, [&](auto &rng){
+      if (std::string(argv[2]).compare("QEF") == 0){
+	run_scenario::QEF(kernel, params, rng, argv, argc);
+      } else if (std::string(argv[2]).compare("LSTM") == 0){
+	run_scenario::LSTM(kernel, params, rng, argv, argc);
+      }
+    });
+
   }
   /**
-     @details Calls initialise_rng(), HSE::parse_parameter_values(), HSE::get_fitness_function(), calls calculate_conditional_existence_probability(), and finally calls
-     print::print_results().
+     @brief Estimates the run time of a point of the Haploid Single Environment model (see cost_model)
+     @param[in] argc Number of command line arguments
+     @param[in] argv Array of command line arguments
+     @return Estimated time in seconds on one thread
   */
-  void run_model(int argc, char* argv[]){
-
-    std::mt19937 rng = rng::initialise_rng();
+  double estimate_cost(int argc, char* argv[]){
     const parameters::HSE_Model_Parameters params = parse_parameter_values(argc, argv);
-    const std::vector<double> fitnesses = get_fitness_function(params);
-
-    if (std::string(argv[2]).compare("QEF") == 0){
-      run_scenario::QEF(params, rng, fitnesses, calculate_trait_freqs, argv, argc);
-    } else if (std::string(argv[2]).compare("LSTM") == 0){
-      run_scenario::LSTM(params, rng, fitnesses, calculate_trait_freqs, argv, argc);
-    }
-    
+    const Kernel kernel(params, get_fitness_function(params));
+    // an LSTM point runs number_replicates_QEF replicates and records the first number_replicates_LSTM of them
+    const int number_recorded = std::string(argv[2]).compare("LSTM") == 0 ? params.fixed.number_replicates_LSTM : 0;
+    return cost_model::estimate(kernel, params, params.fixed.number_replicates_QEF, 1, run_options::get().seed,
+				number_recorded);
   }
 
 }
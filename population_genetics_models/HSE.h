@@ -7,8 +7,8 @@
 #define HSE_H
 
 #include <vector>
-#include <random>
 #include "Parameters.h"
+#include "haploid_kernel.h"
 
 /**
    @brief Namespace for Haploid Single Environment
@@ -30,16 +30,9 @@ namespace HSE {
   */
   const std::vector<double> get_fitness_function(const parameters::HSE_Model_Parameters &parameters);
   /**
-     @brief Calculates frequency of the trait after selection
-     @param[in, out] trait_freq The frequency of the trait (allele A)
-     @param[in] fitnesses A vector containing the fitnesses of the A and a alleles [wA, wa]
-     @param[in] parameters::HSE_Model_Parameters::Shared_Parameters::population_size Number of individuals in the population
-     @param[in, out] rng Random number generator
-     @param[in, out] gen Current generation
-     @return Nothing (but modifies \p trait_freq and \p gen)
+     @brief Per-generation kernel of the Haploid Single Environment model (see haploid_kernel::Single_Environment)
   */
-  void calculate_allele_freqs(std::vector<double> &trait_freq, const std::vector<double> &fitnesses,
-			      const parameters::HSE_Model_Parameters &parameters, std::mt19937 &rng, int &gen);
+  using Kernel = haploid_kernel::Single_Environment<parameters::HSE_Model_Parameters>;
   /**
      @brief Runs Haploid Single Environment model
      @param[in] argc Number of command line arguments
@@ -47,6 +40,13 @@ namespace HSE {
      @return Nothing (but prints results)
   */
   void run_model(int argc, char* argv[]);
+  /**
+     @brief Estimates the run time of a point of the model (used to schedule sweeps; see cost_model)
+     @param[in] argc Number of command line arguments
+     @param[in] argv Array of command line arguments
+     @return Estimated time in seconds on one thread
+  */
+  double estimate_cost(int argc, char* argv[]);
 
 }
 
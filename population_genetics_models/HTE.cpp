@@ -1,14 +1,16 @@
+#include <algorithm>
 #include <cassert>
 #include <string>
 #include <vector>
-#include <numeric>
-#include <random>
 #include "Parameters.h"
 #include "HTE.h"
+#include "environment_schedule.h"
 #include "rng.h"
 #include "conditional_existence_probability.h"
+#include "cost_model.h"
 #include "trait_invasion.h"
 #include "run_scenario.h"
+#include "run_options.h"
 
 namespace HTE {
   /**
@@ -52,29 +54,6 @@ namespace HTE {
       1.0 + parameters.model.selection_coefficient_a_env_2};
     return fitnesses;
   }
-  /**
-     @brief Calculates frequency of the trait after selection
-     @param[in, out] trait_freq The frequency of the trait (A allele)
-     @param[in] fitnesses A vector containing the fitnesses of the A and a alleles [wA, wa]
-     @param[in] parameters::HTE_Model_Parameters::Shared_Parameters::population_size Number of individuals in the population
-     @param[in, out] rng Random number generator
-     @param[in, out] gen The current generation
-     @return Nothing (but modifies \p trait_freq and increments \p gen)
-  */
-  void calculate_trait_freqs(std::vector<double> &trait_freq, const std::vector<double> &fitnesses,
-			     const parameters::HTE_Model_Parameters &parameters, std::mt19937 &rng, int &gen){
-    std::vector<double> expected_allele_freq_raw(2);
-    expected_allele_freq_raw[0] = trait_freq[0] * fitnesses[gen >= parameters.model.gen_env_1];
-    expected_allele_freq_raw[1] = (1.0 - trait_freq[0]) * fitnesses[2 + (gen >= parameters.model.gen_env_1)];
-    // calculate normalised expectation of trait_freq
-    double expectation = expected_allele_freq_raw[0] / (std::accumulate(expected_allele_freq_raw.begin(),
-									expected_allele_freq_raw.end(), 0.0));
-    // sample to get realised allele_A_freq
-    std::binomial_distribution<int> surviving_As(parameters.shared.population_size, expectation);
-    trait_freq[0] =
-      static_cast<double>(surviving_As(rng)) / static_cast<double>(parameters.shared.population_size);
-    ++gen;
-  }
   /**
      @brief Runs Haploid Two Effects model
      @param[in] argc Number of command line arguments
@@ -82,10 +61,56 @@ namespace HTE {
      @return Nothing (but prints results)
   */
   void run_model(int argc, char* argv[]){
-    std::mt19937 rng = rng::initialise_rng();
     const parameters::HTE_Model_Parameters params = parse_parameter_values(argc, argv);
-    const std::vector<double> fitnesses = get_fitness_function(params);
-    run_scenario::QEF(params, rng, fitnesses, calculate_trait_freqs, argv, argc);
+    const run_options::Run_Options &options = run_options::get();
+    const environment_schedule::Schedule schedule(options.environment_schedule, params.model.gen_env_1,
+						  Kernel::number_environments);
+    assert((schedule.deterministic() || (options.engine.compare("scalar") == 0 && options.sampler.compare("binomial") == 0))
+	   && "--environment_schedule=markov needs --engine=scalar and --sampler=binomial");
+    const Kernel kernel(params, get_fitness_function(params), schedule);
+    if (!options.switch_generations.empty()){
+      assert(options.environment_schedule.compare("switch") == 0 &&
+	     "--switch_generations sweeps the switch schedule (not --environment_schedule)");
+      // one run per switch generation, forked from a shared environment-1 prefix (see environment_fork)
+      std::vector<int> switch_generations = options.switch_generations;
+      std::sort(switch_generations.begin(), switch_generations.end());
+      switch_generations.erase(std::unique(switch_generations.begin(), switch_generations.end()),
+			       switch_generations.end());
+      std::vector<parameters::HTE_Model_Parameters> sweep_params;
+      std::vector<Kernel> kernels;
+      for (const int gen_env_1 : switch_generations){
+	sweep_params.push_back({params.shared, {params.model.selection_coefficient_A_env_1,
+	      params.model.selection_coefficient_A_env_2, params.model.selection_coefficient_a_env_1,
+	      params.model.selection_coefficient_a_env_2, gen_env_1}});
+	kernels.emplace_back(sweep_params.back(), get_fitness_function(sweep_params.back()));
+      }
+      rng::with_engine(options.rng_engine, options.seed, [&](auto &rng){
+	run_scenario::QEF_switch_sweep(kernels, sweep_params, switch_generations, params, rng, argv, argc);
+      });
+      return;
+    }
+    rng::with_engine(options.rng_engine, options.seed, [&](auto &rng){
+      run_scenario::QEF(kernel, params, rng, argv, argc);
+    });
+  }
+  /**
+     @brief Estimates the run time of a point of the Haploid Two Effects model (see cost_model)
+     @param[in] argc Number of command line arguments
+     @param[in] argv Array of command line arguments
+     @return Estimated time in seconds on one thread
+  */
+  double estimate_cost(int argc, char* argv[]){
+    const parameters::HTE_Model_Parameters params = parse_parameter_values(argc, argv);
+    const run_options::Run_Options &options = run_options::get();
+    const environment_schedule::Schedule schedule(options.environment_schedule, params.model.gen_env_1,
+						  Kernel::number_environments);
+    const Kernel kernel(params, get_fitness_function(params), schedule);
+    // a --switch_generations sweep runs every switch generation (from shared prefixes, which this ignores)
+    std::vector<int> switch_generations = options.switch_generations;
+    std::sort(switch_generations.begin(), switch_generations.end());
+    const int number_runs = std::max(1, static_cast<int>(std::unique(switch_generations.begin(),
+								      switch_generations.end()) - switch_generations.begin()));
+    return cost_model::estimate(kernel, params, params.fixed.number_replicates_QEF, number_runs, options.seed);
   }
   
 }
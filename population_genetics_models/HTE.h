@@ -6,9 +6,13 @@
 #ifndef HTE_H
 #define HTE_H
 
+#include <array>
+#include <cmath>
 #include <vector>
-#include <random>
 #include "Parameters.h"
+#include "trait_freq.h"
+#include "binomial.h"
+#include "environment_schedule.h"
 
 /**
    @brief Namespace for Haploid Two Environments
@@ -30,6 +34,8 @@
    parameters::HTE_Model_Parameters::HTE_Specific_Parameters::gen_env_1 generations, which is followed by environment 2 
    existing for the remaining generations (until fixation or loss). One interpretation of this model is the 
    evolved for/maintained by distinction (where evolved for is env 1 and maintained by is env 2).
+   Piecewise, periodic and Markov-switching regimes over the two environments can be run with
+   --environment_schedule (see environment_schedule).
 */
 namespace HTE {
 
@@ -37,10 +43,78 @@ namespace HTE {
   
   const std::vector<double> get_fitness_function(const parameters::HTE_Model_Parameters &parameters);
 
-  void calculate_allele_freqs(std::vector<double> &trait_freq, const std::vector<double> &fitnesses,
-			      const parameters::HTE_Model_Parameters &parameters, std::mt19937 &rng, int &gen);
+  /**
+     @brief Per-generation kernel of the Haploid Two Environments model
+     @details Constants are fixed at construction (N, the allele fitnesses in each environment and the environment
+     schedule). With the default schedule generation \p gen is in environment 2 if gen >= gen_env_1
+     (see environment_schedule for the others).
+  */
+  struct Kernel {
+    using Parameters = parameters::HTE_Model_Parameters;
+    static constexpr int number_environments = 2;
+    const int population_size; /**< Number of individuals in the population */
+    const double fitness_A[2]; /**< [wA_1, wA_2] */
+    const double fitness_a[2]; /**< [wa_1, wa_2] */
+    const environment_schedule::Schedule schedule; /**< Environment of each generation */
+
+    /** @param[in] fitnesses Allele fitnesses [wA_1, wA_2, wa_1, wa_2] (from get_fitness_function) */
+    Kernel(const Parameters &parameters, const std::vector<double> &fitnesses)
+      : Kernel(parameters, fitnesses, environment_schedule::Schedule("switch", parameters.model.gen_env_1,
+								       number_environments)) {}
+    /** @param[in] schedule Environment schedule (--environment_schedule) */
+    Kernel(const Parameters &parameters, const std::vector<double> &fitnesses,
+	   const environment_schedule::Schedule &schedule)
+      : population_size(parameters.shared.population_size),
+	fitness_A{fitnesses[0], fitnesses[1]}, fitness_a{fitnesses[2], fitnesses[3]},
+	schedule(schedule) {}
+    /** @brief Environment in generation \p gen (0: environment 1; 1: environment 2; deterministic schedules) */
+    int environment(const int gen) const {
+      return schedule.environment(gen);
+    }
+    /** @brief Expected frequency of allele A after selection, given \p count A alleles in generation \p gen */
+    double expectation(const int count, const int gen) const {
+      return expectation_in_environment(count, environment(gen));
+    }
+    /** @brief Expected frequency of allele A after selection in environment \p env */
+    double expectation_in_environment(const int count, const int env) const {
+      // selects rather than indexed loads, so that batched_invasion vectorises over lanes without a gather
+      const double wA_1 = fitness_A[0], wA_2 = fitness_A[1], wa_1 = fitness_a[0], wa_2 = fitness_a[1];
+      const double wA = env == 0 ? wA_1 : wA_2;
+      const double wa = env == 0 ? wa_1 : wa_2;
+      const double raw_A = count * wA;
+      return raw_A / (raw_A + (population_size - count) * wa);
+    }
+    /**
+       @brief Mean and variance of the frequency of allele A in the next generation, given frequency \p freq in
+       environment \p env (the diffusion limit used by backward_equation)
+    */
+    std::array<double, 2> frequency_moments(const double freq, const int env) const {
+      const double raw_A = freq * fitness_A[env];
+      const double mean = raw_A / (raw_A + (1.0 - freq) * fitness_a[env]);
+      return {mean, mean * (1.0 - mean) / population_size};
+    }
+    /** @brief Environment of every generation from \p gen on (-1 if it still changes; see absorbing_shortcut) */
+    int final_environment(const int gen) const {
+      return schedule.final_environment(gen);
+    }
+    /** @brief Selection coefficient log(wA / wa) of the diffusion limit in environment \p env */
+    double selection_coefficient(const int env) const {
+      return std::log(fitness_A[env] / fitness_a[env]);
+    }
+    /** @brief Advances \p trait_count by one generation (selection then binomial sampling) */
+    template <class R>
+    void step(trait_freq::trait_counts<Parameters> &trait_count, R &rng, const int gen) const {
+      trait_count[0] = binomial::sample(rng, population_size, expectation(trait_count[0], gen));
+    }
+    /** @brief Advances \p trait_count by one generation in environment \p env (one segment of the schedule) */
+    template <class R>
+    void step_in_environment(trait_freq::trait_counts<Parameters> &trait_count, R &rng, const int env) const {
+      trait_count[0] = binomial::sample(rng, population_size, expectation_in_environment(trait_count[0], env));
+    }
+  };
   
   void run_model(int argc, char* argv[]);
+  double estimate_cost(int argc, char* argv[]);
 
 }
 
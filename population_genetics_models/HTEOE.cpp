@@ -1,14 +1,14 @@
 #include <cassert>
 #include <string>
 #include <vector>
-#include <numeric>
-#include <random>
 #include "Parameters.h"
 #include "HTEOE.h"
 #include "rng.h"
 #include "conditional_existence_probability.h"
+#include "cost_model.h"
 #include "trait_invasion.h"
 #include "run_scenario.h"
+#include "run_options.h"
 
 namespace HTEOE {
 
@@ -50,29 +50,6 @@ namespace HTEOE {
        1.0 + parameters.model.selection_coefficient_a1 + parameters.model.selection_coefficient_a2}; 
     return fitnesses;
   }
-  /**
-     @brief Calculates frequency of the trait after selection
-     @param[in, out] trait_freq The frequency of the trait (A allele)
-     @param[in] fitnesses A vector containing the fitnesses of the A and a alleles [wA, wa]
-     @param[in] parameters::HTEOE_Model_Parameters::Shared_Parameters::population_size Number of individuals in the population
-     @param[in, out] rng Random number generator
-     @param[in, out] gen The current generation
-     @return Nothing (but modifies \p trait_freq and increments \p gen)
-  */
-  void calculate_trait_freqs(std::vector<double> &trait_freq, const std::vector<double> &fitnesses,
-			     const parameters::HTEOE_Model_Parameters &parameters, std::mt19937 &rng, int &gen){
-    std::vector<double> expected_allele_freq_raw(2);
-    expected_allele_freq_raw[0] = trait_freq[0] * fitnesses[0];
-    expected_allele_freq_raw[1] = (1.0 - trait_freq[0]) * fitnesses[1];
-    // calculate normalised expectation of trait_freq
-    double expectation = expected_allele_freq_raw[0] / (std::accumulate(expected_allele_freq_raw.begin(),
-									expected_allele_freq_raw.end(), 0.0));
-    // sample to get realised trait_freq
-    std::binomial_distribution<int> surviving_As(parameters.shared.population_size, expectation);
-    trait_freq[0] =
-      static_cast<double>(surviving_As(rng)) / static_cast<double>(parameters.shared.population_size);
-    ++gen;
-  }
   /**
      @brief Runs Haploid Two Effects One Environment model
      @param[in] argc Number of command line arguments
@@ -80,10 +57,23 @@ namespace HTEOE {
      @return Nothing (but prints results)
   */
   void run_model(int argc, char* argv[]){
-    std::mt19937 rng = rng::initialise_rng();
     const parameters::HTEOE_Model_Parameters params = parse_parameter_values(argc, argv);
-    const std::vector<double> fitnesses = get_fitness_function(params);
-    run_scenario::QEF(params, rng, fitnesses, calculate_trait_freqs, argv, argc);
+    const Kernel kernel(params, get_fitness_function(params));
+    const run_options::Run_Options &options = run_options::get();
+    rng::with_engine(options.rng_engine, options.seed, [&](auto &rng){
+      run_scenario::QEF(kernel, params, rng, argv, argc);
+    });
+  }
+  /**
+     @brief Estimates the run time of a point of the Haploid Two Effects One Environment model (see cost_model)
+     @param[in] argc Number of command line arguments
+     @param[in] argv Array of command line arguments
+     @return Estimated time in seconds on one thread
+  */
+  double estimate_cost(int argc, char* argv[]){
+    const parameters::HTEOE_Model_Parameters params = parse_parameter_values(argc, argv);
+    const Kernel kernel(params, get_fitness_function(params));
+    return cost_model::estimate(kernel, params, params.fixed.number_replicates_QEF, 1, run_options::get().seed);
   }
 
 }
@@ -7,8 +7,8 @@
 #define HTEOE_H
 
 #include <vector>
-#include <random>
 #include "Parameters.h"
+#include "haploid_kernel.h"
 
 /**
    @brief Namespace for Haploid Two Effects One Environment
@@ -28,10 +28,14 @@ namespace HTEOE {
   
   const std::vector<double> get_fitness_function(const parameters::HTEOE_Model_Parameters &parameters);
 
-  void calculate_allele_freqs(std::vector<double> &trait_freq, const std::vector<double> &fitnesses,
-			      const parameters::HTEOE_Model_Parameters &parameters, std::mt19937 &rng, int &gen);
+  /**
+     @brief Per-generation kernel of the Haploid Two Effects One Environment model, whose allele fitnesses wA and
+     wa each combine both effects (see haploid_kernel::Single_Environment)
+  */
+  using Kernel = haploid_kernel::Single_Environment<parameters::HTEOE_Model_Parameters>;
 
   void run_model(int argc, char* argv[]);
+  double estimate_cost(int argc, char* argv[]);
 
 }
 
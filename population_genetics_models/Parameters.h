@@ -17,25 +17,34 @@ namespace parameters {
     const int population_size; /**< Number of individuals in the population */
     const double initial_trait_freq; /**< Initial frequency of the trait  */
     const int number_reinvasions; /**< Number of reinvasion attempts that the trait faces */
-    /** First element is index of trait in \p trait_freq; second element is number of traits to track */
+    /** First element is index of trait in \p trait_count; second element is number of traits to track */
     const std::vector<int> trait_info;
   };
   /**
      @brief Struct containing constant parameter values (fixed for all models)
   */
   struct Fixed_Parameters {
-    inline static const double tolerance = fixed_parameters::tolerance; /**< Tolerance for comparing doubles */
     /** Number of independent stochastic replicates that are run for the QEF inference */
     inline static const int number_replicates_QEF = fixed_parameters::number_replicates_QEF;
     /** Number of independent stochastic replicates that are run for the LSTM inference */
     inline static const int number_replicates_LSTM = fixed_parameters::number_replicates_LSTM;
     /** Max number of generations to run a replicate (prevents a stable polymorphism causing an infinite loop) */
     inline static const int max_generations_per_sim = fixed_parameters::max_generations_per_sim;
+    /** Number of replicates per parallel task (fixed so that output does not depend on the number of threads) */
+    inline static const int replicates_per_chunk = fixed_parameters::replicates_per_chunk;
+    /** Number of replicates per parallel task of the ensemble engine (larger chunks, since work scales with occupied counts) */
+    inline static const int replicates_per_ensemble = fixed_parameters::replicates_per_ensemble;
+    /** Transition probabilities below this are dropped from the band of the exact (Markov chain) solver */
+    inline static const double exact_band_tolerance = fixed_parameters::exact_band_tolerance;
+    /** The exact solver stops once the probability that the invasion attempt is unresolved falls below this */
+    inline static const double exact_convergence_tolerance = fixed_parameters::exact_convergence_tolerance;
   };
   /**
      @brief Struct for parameters of the Haploid Single Environment model
   */
   struct HSE_Model_Parameters {
+    static constexpr int number_traits = 1; /**< Size of the trait state (#A) */
+    static constexpr int ploidy = 1; /**< Copies of the locus per individual (haploid) */
     Shared_Parameters shared;
     struct HSE_Specific_Parameters {
       const double selection_coefficient; /**< Selection coefficient of allele A */
@@ -47,6 +56,8 @@ namespace parameters {
      @brief Struct for parameters of the Diploid Single Environment model
   */
   struct DSE_Model_Parameters {
+    static constexpr int number_traits = 2; /**< Size of the trait state (#AA, #Aa) */
+    static constexpr int ploidy = 2; /**< Copies of the locus per individual (diploid) */
     Shared_Parameters shared;
     struct DSE_Specific_Parameters {
       const double selection_coefficient_homozygote; /**< Selection coefficient of the AA genotype */
@@ -58,6 +69,8 @@ namespace parameters {
      @brief Struct for parameters of the Haploid Two Environments model
   */
   struct HTE_Model_Parameters {
+    static constexpr int number_traits = 1; /**< Size of the trait state (#A) */
+    static constexpr int ploidy = 1; /**< Copies of the locus per individual (haploid) */
     Shared_Parameters shared;
     struct HTE_Specific_Parameters {
       const double selection_coefficient_A_env_1; /**< Selection coefficient of the A allele in environment 1 */
@@ -73,6 +86,8 @@ namespace parameters {
      @brief Struct for parameters of the Haploid Two Effects One Environment model
   */
   struct HTEOE_Model_Parameters {
+    static constexpr int number_traits = 1; /**< Size of the trait state (#A) */
+    static constexpr int ploidy = 1; /**< Copies of the locus per individual (haploid) */
     Shared_Parameters shared;
     struct HTEOE_Specific_Parameters {
       const double selection_coefficient_A1; /**< Selection coefficient of the A allele's 1st effect */
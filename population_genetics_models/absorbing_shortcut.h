@@ -0,0 +1,100 @@
+/**
+   @file absorbing_shortcut.h
+   @brief Jumps haploid replicates that are almost certain to fix straight to fixation (--shortcut=epsilon)
+*/
+#ifndef ABSORBING_SHORTCUT_H
+#define ABSORBING_SHORTCUT_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include "Parameters.h"
+#include "run_options.h"
+
+/**
+   @brief Namespace for the absorbing-state shortcut
+   @details Once allele A is far above the drift barrier its trajectory to fixation is almost deterministic, yet
+   simulating it takes most of the generations of a replicate that persists. When the environment no longer
+   changes (K::final_environment) and selection favours A (s = log(wA / wa) > 0), the probability that c copies are
+   still lost is at most exp(-2 s c) (diffusion limit; Kimura's loss probability is smaller). Once that is below
+   epsilon the replicate jumps to the outcome it would reach:
+   - the frequency follows the logistic curve, logit(x) increasing by s per generation (exact for the expected
+   haploid Wright-Fisher step), so fixation takes ceil((log(2N - 1) - logit(c / N)) / s) more generations
+   - if that passes max_generations_per_sim, the replicate stops at max_generations_per_sim with the count on the
+   logistic curve (it persists either way)
+
+   Each invasion attempt jumps at most once, so the distribution of a replicate's outcome is off by at most
+   (1 + number_reinvasions) * epsilon (recorded as "shortcut_error_bound", see record_context).
+*/
+namespace absorbing_shortcut {
+  /** @brief True for the model kernels that the shortcut supports (haploid: a single count) */
+  template <class K>
+  struct has_shortcut : std::bool_constant<K::Parameters::number_traits == 1> {};
+  /**
+     @brief Shortcut for one kernel and epsilon (counts above which a replicate jumps, per environment)
+     @details Never jumps for kernels without has_shortcut (DSE), so it can be used by any invasion loop.
+  */
+  template <class K>
+  class Shortcut {
+  public:
+    Shortcut(const K &kernel, const typename K::Parameters &params, const double epsilon)
+      : population_size(params.shared.population_size), max_gen(params.fixed.max_generations_per_sim),
+	enabled(epsilon > 0.0 && has_shortcut<K>::value) {
+      if constexpr (has_shortcut<K>::value){
+	for (int env = 0; env < K::number_environments; env++){
+	  selection[env] = kernel.selection_coefficient(env);
+	  // P(loss) <= exp(-2 s c) < epsilon for c above this
+	  threshold_count[env] = selection[env] > 0.0 && enabled ? -std::log(epsilon) / (2.0 * selection[env]) :
+	    std::numeric_limits<double>::infinity();
+	}
+      }
+    }
+    /** @brief Shortcut with the epsilon of the run options */
+    Shortcut(const K &kernel, const typename K::Parameters &params)
+      : Shortcut(kernel, params, run_options::get().shortcut_epsilon) {}
+    /**
+       @brief Jumps \p count (in generation \p gen, with the attempt still running) to its absorbing outcome if
+       the probability of loss is below epsilon
+       @return True if the replicate jumped (\p count is then N, or \p gen is max_generations_per_sim)
+    */
+    bool absorb(const K &kernel, int &count, int &gen) const {
+      if constexpr (!has_shortcut<K>::value){
+	return false;
+      } else {
+	return enabled && jump(kernel, count, gen);
+      }
+    }
+
+  private:
+    bool jump(const K &kernel, int &count, int &gen) const {
+      const int env = kernel.final_environment(gen);
+      if (env < 0 || count <= threshold_count[env]){
+	return false;
+      }
+      const double s = selection[env];
+      const double logit = std::log(static_cast<double>(count) / (population_size - count));
+      const double generations = std::ceil((std::log(2.0 * population_size - 1.0) - logit) / s);
+      if (gen + generations < max_gen){
+	count = population_size;
+	gen += static_cast<int>(generations);
+      } else {
+	const double final_logit = logit + s * (max_gen - gen);
+	count = std::clamp(static_cast<int>(std::lround(population_size / (1.0 + std::exp(-final_logit)))), count,
+			   population_size - 1);
+	gen = max_gen;
+      }
+      return true;
+    }
+
+    int population_size;
+    int max_gen;
+    bool enabled;
+    std::array<double, K::number_environments> selection {}; /**< log(wA / wa) in each environment */
+    std::array<double, K::number_environments> threshold_count {};
+  };
+
+}
+
+#endif
@@ -0,0 +1,274 @@
+/**
+   @file alias_table.h
+   @brief Tabulated transition sampling (Walker alias tables) for the population genetics models
+*/
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+#include "Parameters.h"
+#include "binomial.h"
+#include "markov_chain.h"
+#include "trait_freq.h"
+
+/**
+   @brief Namespace for the alias table sampler (--sampler=alias)
+   @details For fixed parameters the distribution of the next state depends only on the current state (and, for
+   HTE, the environment). Tabulated_Kernel wraps a model kernel and samples the next state from a Walker alias
+   table of that distribution, which costs one uniform draw and one table lookup per generation.
+   - haploid models: one table per (environment, #A); outcomes are the band of Binomial(N, p) (see
+   markov_chain::Binomial_Pmf)
+   - DSE: one table per (#AA, #Aa); outcomes are pairs (AA, Aa) from the bands of the conditional binomials
+   used by DSE::Kernel::step
+
+   Tables are built lazily (on the first visit to a state) and only for states with few copies of allele A, where
+   invading alleles spend most generations. How many states get a table is fixed before the run from an estimate
+   of the table sizes and fixed_parameters::alias_table_budget_bytes, so the random numbers drawn (and hence the
+   output) do not depend on the order in which threads visit states. Other states use the kernel's own step.
+*/
+namespace alias_table {
+  /**
+     @brief Walker alias table over the outcomes 0, ..., size - 1 (built with Vose's method)
+  */
+  class Alias_Table {
+  public:
+    Alias_Table() = default;
+    /** @param[in] weights Non-negative weights of the outcomes (need not be normalised) */
+    explicit Alias_Table(const std::vector<double> &weights)
+      : probability(weights.size()), alias(weights.size()) {
+      const int size = static_cast<int>(weights.size());
+      double total = 0.0;
+      for (const double weight : weights){
+	total += weight;
+      }
+      std::vector<int> small, large;
+      for (int k = 0; k < size; k++){
+	probability[k] = weights[k] * size / total;
+	alias[k] = k;
+	(probability[k] < 1.0 ? small : large).push_back(k);
+      }
+      while (!small.empty() && !large.empty()){
+	const int under = small.back();
+	const int over = large.back();
+	small.pop_back();
+	alias[under] = over;
+	probability[over] -= 1.0 - probability[under];
+	if (probability[over] < 1.0){
+	  large.pop_back();
+	  small.push_back(over);
+	}
+      }
+      for (const int k : small){ // only rounding error remains
+	probability[k] = 1.0;
+      }
+      for (const int k : large){
+	probability[k] = 1.0;
+      }
+    }
+    /** @brief Samples an outcome using a single uniform draw */
+    template <class R>
+    int sample(R &rng) const {
+      const double u = binomial::uniform_01(rng) * probability.size();
+      const int k = std::min(static_cast<int>(u), static_cast<int>(probability.size()) - 1);
+      return u - k < probability[k] ? k : alias[k];
+    }
+
+  private:
+    std::vector<double> probability;
+    std::vector<int> alias;
+  };
+  /**
+     @brief Estimated number of outcomes in the band of Binomial(n, p) (used to plan the memory budget)
+  */
+  inline double estimated_band_width(const int n, const double p, const double tolerance){
+    return 1.0 + 2.0 * std::ceil(std::sqrt(-2.0 * std::log(tolerance) * n * p * (1.0 - p)));
+  }
+  template <class K> class Tabulated_Kernel;
+  /** @brief True for kernels that are already tabulated */
+  template <class K> struct is_tabulated : std::false_type {};
+  template <class K> struct is_tabulated<Tabulated_Kernel<K>> : std::true_type {};
+  /**
+     @brief Model kernel whose step samples the next state from lazily built alias tables
+     @details Has the same interface as the kernel it wraps (see HSE::Kernel) so it can be used by the
+     per-replicate engine.
+  */
+  template <class K>
+  class Tabulated_Kernel {
+  public:
+    using Parameters = typename K::Parameters;
+    using State = trait_freq::trait_counts<Parameters>;
+    static constexpr int number_environments = K::number_environments;
+
+    Tabulated_Kernel(const K &kernel, const Parameters &params)
+      : kernel(kernel), tables(std::make_shared<Tables>(kernel, params)) {}
+    int environment(const int gen) const {
+      return kernel.environment(gen);
+    }
+    double expectation(const int count, const int gen) const {
+      return kernel.expectation(count, gen);
+    }
+    double expectation_in_environment(const int count, const int env) const {
+      return kernel.expectation_in_environment(count, env);
+    }
+    std::array<double, 3> genotype_weights(const State &trait_count) const {
+      return kernel.genotype_weights(trait_count);
+    }
+    std::array<double, 2> frequency_moments(const double freq, const int env) const {
+      return kernel.frequency_moments(freq, env);
+    }
+    int final_environment(const int gen) const {
+      return kernel.final_environment(gen);
+    }
+    double selection_coefficient(const int env) const {
+      return kernel.selection_coefficient(env);
+    }
+    /** @brief Advances \p trait_count by one generation (from its alias table if it has one) */
+    template <class R>
+    void step(State &trait_count, R &rng, const int gen) const {
+      const Entry* entry = tables->find(kernel, trait_count, gen);
+      if (entry == nullptr){
+	kernel.step(trait_count, rng, gen);
+      } else {
+	trait_count = entry->outcomes[entry->table.sample(rng)];
+      }
+    }
+
+  private:
+    /** Alias table of the next state from one state */
+    struct Entry {
+      Alias_Table table;
+      std::vector<State> outcomes;
+    };
+    /** Tables of all states, shared by all copies of the kernel (and hence by all threads) */
+    class Tables {
+    public:
+      Tables(const K &kernel, const Parameters &params)
+	: population_size(params.shared.population_size), tolerance(params.fixed.exact_band_tolerance),
+	  log_factorial(markov_chain::log_factorials(params.shared.population_size)) {
+	const double budget = static_cast<double>(fixed_parameters::alias_table_budget_bytes);
+	const double slot_bytes = sizeof(Entry) + sizeof(std::once_flag);
+	const double outcome_bytes = sizeof(double) + sizeof(int) + sizeof(State);
+	double bytes = 0.0;
+	if constexpr (Parameters::number_traits == 1){
+	  // tables for counts 1..max_copies in every environment
+	  while (max_copies < population_size - 1){
+	    double count_bytes = 0.0;
+	    for (int env = 0; env < number_environments; env++){
+	      const double p = kernel.expectation_in_environment(max_copies + 1, env);
+	      count_bytes += slot_bytes + outcome_bytes * estimated_band_width(population_size, p, tolerance);
+	    }
+	    if (bytes + count_bytes > budget){
+	      break;
+	    }
+	    bytes += count_bytes;
+	    max_copies++;
+	  }
+	  number_slots = static_cast<std::size_t>(number_environments) * max_copies;
+	} else {
+	  // tables for states with 2 * #AA + #Aa <= max_copies (slots are laid out by #AA, then #Aa)
+	  while (max_copies < 2 * population_size - 1){
+	    const int copies = max_copies + 1;
+	    double copies_bytes = 0.0;
+	    for (int AA = 0; 2 * AA <= copies; AA++){
+	      const int Aa = copies - 2 * AA;
+	      copies_bytes += slot_bytes;
+	      if (AA + Aa <= population_size){
+		const auto [p_AA, p_Aa] = conditional_probabilities(kernel, {AA, Aa});
+		copies_bytes += outcome_bytes * estimated_band_width(population_size, p_AA, tolerance) *
+		  estimated_band_width(population_size, p_Aa, tolerance);
+	      }
+	    }
+	    if (bytes + copies_bytes > budget){
+	      break;
+	    }
+	    bytes += copies_bytes;
+	    max_copies++;
+	  }
+	  for (int AA = 0; 2 * AA <= max_copies; AA++){
+	    row_offset.push_back(number_slots);
+	    number_slots += max_copies - 2 * AA + 1;
+	  }
+	}
+	entries.resize(number_slots);
+	built = std::make_unique<std::once_flag[]>(number_slots);
+      }
+      /** @brief Returns the table of \p state (building it on first use), or nullptr if it has none */
+      const Entry* find(const K &kernel, const State &state, const int gen) const {
+	std::size_t slot;
+	int env = 0;
+	if constexpr (Parameters::number_traits == 1){
+	  if (state[0] < 1 || state[0] > max_copies){
+	    return nullptr;
+	  }
+	  env = kernel.environment(gen);
+	  slot = static_cast<std::size_t>(env) * max_copies + (state[0] - 1);
+	} else {
+	  if (2 * state[0] + state[1] > max_copies || 2 * state[0] + state[1] < 1){
+	    return nullptr;
+	  }
+	  slot = row_offset[state[0]] + state[1];
+	}
+	std::call_once(built[slot], [&](){ entries[slot] = build(kernel, state, env); });
+	return &entries[slot];
+      }
+
+    private:
+      /** @brief P(AA) and P(Aa | not AA) in the next generation (DSE) */
+      static std::array<double, 2> conditional_probabilities(const K &kernel, const State &state){
+	const auto [raw_AA, raw_Aa, raw_aa] = kernel.genotype_weights(state);
+	return {raw_AA / (raw_AA + raw_Aa + raw_aa), raw_Aa + raw_aa > 0.0 ? raw_Aa / (raw_Aa + raw_aa) : 0.0};
+      }
+      Entry build(const K &kernel, const State &state, const int env) const {
+	const double log_tolerance = std::log(tolerance);
+	Entry entry;
+	std::vector<double> weights;
+	if constexpr (Parameters::number_traits == 1){
+	  const markov_chain::Binomial_Pmf pmf(population_size, kernel.expectation_in_environment(state[0], env),
+					       log_factorial);
+	  const auto [lo, hi] = pmf.band(log_tolerance);
+	  for (int j = lo; j <= hi; j++){
+	    weights.push_back(std::exp(pmf.log_pmf(j)));
+	    entry.outcomes.push_back({j});
+	  }
+	} else {
+	  const auto [p_AA, p_Aa] = conditional_probabilities(kernel, state);
+	  const markov_chain::Binomial_Pmf pmf_AA(population_size, p_AA, log_factorial);
+	  const auto [lo_AA, hi_AA] = pmf_AA.band(log_tolerance);
+	  for (int AA = lo_AA; AA <= hi_AA; AA++){
+	    const double log_pmf_AA = pmf_AA.log_pmf(AA);
+	    const markov_chain::Binomial_Pmf pmf_Aa(population_size - AA, p_Aa, log_factorial);
+	    const auto [lo_Aa, hi_Aa] = pmf_Aa.band(log_tolerance - log_pmf_AA);
+	    for (int Aa = lo_Aa; Aa <= hi_Aa; Aa++){
+	      weights.push_back(std::exp(log_pmf_AA + pmf_Aa.log_pmf(Aa)));
+	      entry.outcomes.push_back({AA, Aa});
+	    }
+	  }
+	}
+	entry.table = Alias_Table(weights);
+	return entry;
+      }
+
+      const int population_size;
+      const double tolerance;
+      const std::vector<double> log_factorial;
+      int max_copies = 0; /**< States with at most this many copies of allele A have a table */
+      std::size_t number_slots = 0;
+      std::vector<std::size_t> row_offset; /**< First slot of each #AA (DSE) */
+      mutable std::vector<Entry> entries;
+      std::unique_ptr<std::once_flag[]> built;
+    };
+
+    K kernel;
+    std::shared_ptr<const Tables> tables;
+  };
+
+}
+
+#endif
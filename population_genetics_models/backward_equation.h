@@ -0,0 +1,428 @@
+/**
+   @file backward_equation.h
+   @brief Finite-difference (Kolmogorov equation) solver for the extinction-time distribution of all models
+*/
+#ifndef BACKWARD_EQUATION_H
+#define BACKWARD_EQUATION_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include "include/example.pb.h"
+#include "Parameters.h"
+#include "markov_chain.h"
+#include "thread_pool.h"
+#include "trait_freq.h"
+
+/**
+   @brief Namespace for the diffusion PDE solver (--engine=pde)
+   @details The frequency x of allele A is approximated by a diffusion whose drift m(x, env) and variance
+   v(x, env) per generation are the moments of one Wright-Fisher generation (K::frequency_moments; for DSE,
+   genotypes in Hardy-Weinberg proportions). The backward operator L f = m f' + v f'' / 2 is discretised by finite
+   differences on a grid of frequencies, which gives a birth-death generator on the grid nodes (moves to the
+   neighbouring nodes with rates that match m and v; upwinded where the drift dominates). The distribution over
+   the grid is propagated with the transpose of that generator (explicit steps, several per generation), so a
+   single sweep gives P(lost in generation g) for every g, also when the drift changes with the generation (HTE).
+   - grid: x_k = sin^2(k * pi / (2 M)), which is fine near the absorbing boundaries (spacing about 1 / (4 copies)
+   next to 0 and 1 with the default refinement) and coarse in the middle, so that M grows with sqrt(N)
+   - the diffusion is poor over a single generation of a few copies, so generation 0 and, in later generations, the
+   nodes within fixed_parameters::backward_equation_layer_copies copies of loss or fixation (the boundary layer)
+   take a binomial step with the moments of one generation instead (deposited on the grid); mass that enters the
+   layer during a generation stays there until the next generation
+   - each explicit step is computed in parallel over blocks of nodes on the thread pool
+   - an invasion attempt stops at max_generations_per_sim or once the unresolved probability falls below
+   Fixed_Parameters::exact_convergence_tolerance
+
+   The output has the same keys as markov_chain::calculate().
+*/
+namespace backward_equation {
+  /** @brief Number of copies of allele A in a population where it is fixed (N haploid, 2N diploid) */
+  template <class P>
+  int allele_copies(const P &params){
+    return P::ploidy * params.shared.population_size;
+  }
+  /** @brief Copies of allele A carried by an individual with the trait of interest (A: 1; AA: 2; Aa: 1) */
+  template <class P>
+  int copies_per_trait(const P &params){
+    return params.shared.trait_info[0] == 0 ? P::ploidy : 1;
+  }
+  /** @brief True if the trait of interest persists when allele A fixes (false for the heterozygote Aa) */
+  template <class P>
+  bool fixation_keeps_trait(const P &params){
+    return params.shared.trait_info[0] == 0;
+  }
+  /**
+     @brief Grid of frequencies x_k = sin^2(k * step), k in [0, M], with step = pi / (2 M)
+  */
+  class Grid {
+  public:
+    /**
+       @param[in] number_copies Number of copies of allele A at fixation
+       @param[in] refinement Number of grid intervals between 0 and the frequency of one copy (in sin^-1 sqrt(x))
+    */
+    Grid(const int number_copies, const int refinement){
+      const double half_pi = 2.0 * std::atan(1.0);
+      intervals = std::max(2, static_cast<int>(std::ceil(half_pi * refinement /
+							 std::asin(std::sqrt(1.0 / number_copies)))));
+      step = half_pi / intervals;
+      nodes.resize(intervals + 1);
+      for (int k = 0; k <= intervals; k++){
+	const double root = std::sin(k * step);
+	nodes[k] = root * root;
+      }
+      nodes[0] = 0.0;
+      nodes[intervals] = 1.0;
+    }
+    /** @brief Number of intervals M (nodes are 0, ..., M) */
+    int size() const {
+      return intervals;
+    }
+    double operator[](const int k) const {
+      return nodes[k];
+    }
+    /** @brief Adds \p mass at frequency \p x to the two nodes either side of \p x (preserving the mean) */
+    void deposit(const double x, const double mass, std::vector<double> &distribution) const {
+      const double freq = std::clamp(x, 0.0, 1.0);
+      int k = std::min(static_cast<int>(std::asin(std::sqrt(freq)) / step), intervals - 1);
+      while (k > 0 && freq < nodes[k]){ // guard against rounding in asin
+	k--;
+      }
+      while (k < intervals - 1 && freq > nodes[k + 1]){
+	k++;
+      }
+      const double weight = std::clamp((freq - nodes[k]) / (nodes[k + 1] - nodes[k]), 0.0, 1.0);
+      distribution[k] += mass * (1.0 - weight);
+      distribution[k + 1] += mass * weight;
+    }
+
+  private:
+    int intervals;
+    double step;
+    std::vector<double> nodes;
+  };
+  /**
+     @brief One generation from a node of the boundary layer (a binomial step deposited on the grid)
+  */
+  struct Layer_Step {
+    int node;
+    std::vector<int> targets;
+    std::vector<double> probabilities;
+    double lost = 0.0;
+    double fixed = 0.0;
+  };
+  /**
+     @brief Steps of one environment: probabilities of moving up, moving down or staying at each node in one
+     explicit step, and the binomial steps of the boundary layer (whose nodes do not move in the explicit steps)
+  */
+  struct Rates {
+    std::vector<double> up;
+    std::vector<double> down;
+    std::vector<double> stay;
+    int steps_per_generation = 1;
+    std::vector<Layer_Step> layer;
+  };
+  /**
+     @brief Result of one invasion attempt
+  */
+  struct Attempt {
+    std::vector<double> extinct_by_gen; /**< P(trait lost in generation g) */
+    double extinct = 0.0; /**< P(trait lost) */
+    double fixed = 0.0; /**< P(allele A fixed) (included in extinct_by_gen if fixation removes the trait) */
+    std::vector<double> persisting; /**< Probability at each grid node at the max gen */
+    double truncated = 0.0; /**< Probability lost to the tolerances */
+  };
+  /**
+     @brief Propagates distributions over the grid for one parameter set (caches the steps of each environment)
+  */
+  template <class K>
+  class Solver {
+  public:
+    using Parameters = typename K::Parameters;
+
+    Solver(const K &kernel, const Parameters &params)
+      : kernel(kernel), params(params),
+	grid(allele_copies(params), fixed_parameters::backward_equation_grid_refinement),
+	rates(K::number_environments), built(K::number_environments, false) {}
+    const Grid& get_grid() const {
+      return grid;
+    }
+    /**
+       @brief Runs one invasion attempt
+       @param[in] start Pairs (frequency of allele A, probability) at the start of the attempt
+    */
+    Attempt run_attempt(const std::vector<std::pair<double, double>> &start){
+      const int M = grid.size();
+      const int max_gen = params.fixed.max_generations_per_sim;
+      const bool keeps_trait = fixation_keeps_trait(params);
+      Attempt attempt;
+      std::vector<double> current(M + 1, 0.0), next(M + 1, 0.0), layer_mass;
+      double start_mass = 0.0;
+      double fixed_at_start = 0.0;
+      double lost_at_start = 0.0;
+      for (const auto &[freq, mass] : start){
+	start_mass += mass;
+	binomial_step(freq, kernel.environment(-1), mass, current, lost_at_start, fixed_at_start);
+      }
+      attempt.extinct_by_gen.push_back(lost_at_start + (keeps_trait ? 0.0 : fixed_at_start));
+      attempt.fixed = fixed_at_start;
+      current[0] = 0.0;
+      current[M] = 0.0;
+
+      constexpr int nodes_per_task = fixed_parameters::backward_equation_nodes_per_task;
+      const int tasks = (M + nodes_per_task) / nodes_per_task;
+      std::vector<double> task_mass(tasks);
+      double unresolved = 0.0;
+      for (int k = 1; k < M; k++){
+	unresolved += current[k];
+      }
+      for (int gen = 1; gen <= max_gen && unresolved >= params.fixed.exact_convergence_tolerance; gen++){
+	// the step into generation gen uses the environment of generation gen - 1 (as in invasion::trait_invasion)
+	const Rates &rate = get_rates(kernel.environment(gen - 1));
+	double lost = 0.0, fixed = 0.0;
+	// boundary layer: take the mass out before the explicit steps and add its binomial step afterwards
+	layer_mass.resize(rate.layer.size());
+	for (std::size_t i = 0; i < rate.layer.size(); i++){
+	  layer_mass[i] = current[rate.layer[i].node];
+	  current[rate.layer[i].node] = 0.0;
+	}
+	for (int substep = 0; substep < rate.steps_per_generation; substep++){
+	  thread_pool::get_pool().parallel_for(tasks, [&](int task){
+	    const int begin = std::max(task * nodes_per_task, 1);
+	    const int end = std::min((task + 1) * nodes_per_task, M);
+	    const double* up = rate.up.data();
+	    const double* down = rate.down.data();
+	    const double* stay = rate.stay.data();
+	    const double* source = current.data();
+	    double* destination = next.data();
+	    double mass = 0.0;
+#pragma omp simd reduction(+:mass)
+	    for (int k = begin; k < end; k++){
+	      destination[k] = stay[k] * source[k] + up[k - 1] * source[k - 1] + down[k + 1] * source[k + 1];
+	      mass += destination[k];
+	    }
+	    task_mass[task] = mass;
+	  });
+	  lost += rate.down[1] * current[1];
+	  fixed += rate.up[M - 1] * current[M - 1];
+	  current.swap(next);
+	}
+	// reduce in task order (the result does not depend on the number of threads)
+	unresolved = 0.0;
+	for (int task = 0; task < tasks; task++){
+	  unresolved += task_mass[task];
+	}
+	for (std::size_t i = 0; i < rate.layer.size(); i++){
+	  const Layer_Step &layer = rate.layer[i];
+	  if (layer_mass[i] > 0.0){
+	    for (std::size_t t = 0; t < layer.targets.size(); t++){
+	      current[layer.targets[t]] += layer_mass[i] * layer.probabilities[t];
+	      unresolved += layer_mass[i] * layer.probabilities[t];
+	    }
+	    lost += layer_mass[i] * layer.lost;
+	    fixed += layer_mass[i] * layer.fixed;
+	  }
+	}
+	attempt.extinct_by_gen.push_back(lost + (keeps_trait ? 0.0 : fixed));
+	attempt.fixed += fixed;
+	if (gen == max_gen){ // the trait persists in the replicates that are unresolved at the max gen
+	  attempt.persisting = current;
+	  unresolved = 0.0;
+	}
+      }
+      if (attempt.persisting.empty()){
+	attempt.persisting.assign(M + 1, 0.0);
+      }
+      for (const double probability : attempt.extinct_by_gen){
+	attempt.extinct += probability;
+      }
+      double persists = keeps_trait ? attempt.fixed : 0.0;
+      for (const double probability : attempt.persisting){
+	persists += probability;
+      }
+      attempt.truncated = std::max(0.0, start_mass - attempt.extinct - persists);
+      return attempt;
+    }
+
+  private:
+    /**
+       @brief Deposits the distribution after one generation from frequency \p freq in environment \p env: a
+       binomial draw with the mean of K::frequency_moments and as many draws as give its variance
+    */
+    void binomial_step(const double freq, const int env, const double mass, std::vector<double> &distribution,
+		       double &lost, double &fixed){
+      if (mass <= 0.0){
+	return;
+      }
+      if (freq <= 0.0){ // a replicate that starts without the trait is lost in gen 0
+	lost += mass;
+	return;
+      }
+      const auto [mean, variance] = kernel.frequency_moments(std::min(freq, 1.0), env);
+      if (variance <= 0.0){ // no drift (e.g. allele A is fixed)
+	if (mean <= 0.0){
+	  lost += mass;
+	} else if (mean >= 1.0){
+	  fixed += mass;
+	} else {
+	  grid.deposit(mean, mass, distribution);
+	}
+	return;
+      }
+      const int draws = std::max(1, static_cast<int>(std::lround(mean * (1.0 - mean) / variance)));
+      if (static_cast<int>(log_factorial.size()) <= draws){
+	log_factorial = markov_chain::log_factorials(draws);
+      }
+      const markov_chain::Binomial_Pmf pmf(draws, mean, log_factorial);
+      const auto [lo, hi] = pmf.band(std::log(params.fixed.exact_band_tolerance));
+      for (int j = lo; j <= hi; j++){
+	const double probability = mass * std::exp(pmf.log_pmf(j));
+	if (j == 0){
+	  lost += probability;
+	} else if (j == draws){
+	  fixed += probability;
+	} else {
+	  grid.deposit(static_cast<double>(j) / draws, probability, distribution);
+	}
+      }
+    }
+    /** @brief Explicit-step probabilities of environment \p env (built on first use) */
+    const Rates& get_rates(const int env){
+      if (!built[env]){
+	rates[env] = build_rates(env);
+	built[env] = true;
+      }
+      return rates[env];
+    }
+    Rates build_rates(const int env){
+      const int M = grid.size();
+      const double layer_freq = static_cast<double>(fixed_parameters::backward_equation_layer_copies) /
+	allele_copies(params);
+      Rates rate;
+      std::vector<double> up(M + 1, 0.0), down(M + 1, 0.0), distribution(M + 1, 0.0);
+      double max_rate = 0.0;
+      for (int k = 1; k < M; k++){
+	const double x = grid[k];
+	if (x <= layer_freq || 1.0 - x <= layer_freq){
+	  Layer_Step layer {k};
+	  binomial_step(x, env, 1.0, distribution, layer.lost, layer.fixed);
+	  for (int target = 0; target <= M; target++){
+	    if (distribution[target] > 0.0){
+	      layer.targets.push_back(target);
+	      layer.probabilities.push_back(distribution[target]);
+	      distribution[target] = 0.0;
+	    }
+	  }
+	  rate.layer.push_back(std::move(layer));
+	  continue;
+	}
+	const double below = x - grid[k - 1];
+	const double above = grid[k + 1] - x;
+	const auto [mean, variance] = kernel.frequency_moments(x, env);
+	const double drift = mean - x;
+	// rates such that the mean and variance of a move match drift and variance
+	up[k] = (variance + drift * below) / (above * (above + below));
+	down[k] = (variance - drift * above) / (below * (above + below));
+	if (down[k] < 0.0){ // drift dominates: upwind
+	  down[k] = 0.0;
+	  up[k] = drift / above;
+	} else if (up[k] < 0.0){
+	  up[k] = 0.0;
+	  down[k] = -drift / below;
+	}
+	max_rate = std::max(max_rate, up[k] + down[k]);
+      }
+      rate.steps_per_generation = std::max(1, static_cast<int>(std::ceil(
+	max_rate / fixed_parameters::backward_equation_max_step_probability)));
+      const double dt = 1.0 / rate.steps_per_generation;
+      rate.stay.assign(M + 1, 0.0);
+      for (int k = 1; k < M; k++){ // layer nodes have up = down = 0 and so keep their mass
+	up[k] *= dt;
+	down[k] *= dt;
+	rate.stay[k] = 1.0 - up[k] - down[k];
+      }
+      rate.up = std::move(up);
+      rate.down = std::move(down);
+      return rate;
+    }
+
+    const K &kernel;
+    const Parameters &params;
+    const Grid grid;
+    std::vector<Rates> rates;
+    std::vector<bool> built;
+    std::vector<double> log_factorial;
+  };
+  /**
+     @brief Calculates the distributions of generation_of_extinction and number_reinvasions from the diffusion PDE
+     @details Writes the same FloatList keys as markov_chain::calculate() ("generation_of_extinction_probability",
+     "trait_persists_probability", "number_reinvasions_probability" and "truncated_probability") and the number of
+     grid intervals as "pde_grid_intervals" (Int64List).
+  */
+  template <class K>
+  void calculate(const K &kernel, const typename K::Parameters &params,
+		 google::protobuf::Map<std::string, tensorflow::Feature>* feature_map){
+    Solver<K> solver(kernel, params);
+    const Grid &grid = solver.get_grid();
+    const int M = grid.size();
+    // frequency of allele A carried by invader_count individuals with the trait
+    const double invader_freq = static_cast<double>(trait_freq::invader_count(params) * copies_per_trait(params)) /
+      allele_copies(params);
+    const bool keeps_trait = fixation_keeps_trait(params);
+    Attempt attempt = solver.run_attempt({{invader_freq, 1.0}});
+    double truncated = attempt.truncated;
+    // probability that the trait persists at the end of an attempt
+    auto persists = [&](const Attempt &result){
+      double probability = keeps_trait ? result.fixed : 0.0;
+      for (const double node : result.persisting){
+	probability += node;
+      }
+      return probability;
+    };
+
+    tensorflow::Feature gen_extinct = tensorflow::Feature();
+    std::vector<double> &extinct_by_gen = attempt.extinct_by_gen;
+    while (!extinct_by_gen.empty() && extinct_by_gen.back() == 0.0){
+      extinct_by_gen.pop_back();
+    }
+    gen_extinct.mutable_float_list()->mutable_value()->Add(extinct_by_gen.begin(), extinct_by_gen.end());
+    tensorflow::Feature trait_persists = tensorflow::Feature();
+    trait_persists.mutable_float_list()->add_value(persists(attempt));
+
+    // reinvasion attempts start from the persisting distribution with invader_count individuals replaced
+    tensorflow::Feature reinvasions = tensorflow::Feature();
+    tensorflow::FloatList* reinvasion_probability = reinvasions.mutable_float_list();
+    reinvasion_probability->add_value(attempt.extinct); // -1: lost in the initial invasion
+    for (int reinvasion = 0; reinvasion < params.shared.number_reinvasions; reinvasion++){
+      std::vector<std::pair<double, double>> start;
+      if (keeps_trait){
+	start.emplace_back(1.0 - invader_freq, attempt.fixed);
+      }
+      for (int k = 1; k < M; k++){
+	if (attempt.persisting[k] > 0.0){
+	  start.emplace_back(grid[k] - invader_freq, attempt.persisting[k]);
+	}
+      }
+      attempt = solver.run_attempt(start);
+      truncated += attempt.truncated;
+      reinvasion_probability->add_value(attempt.extinct);
+    }
+    reinvasion_probability->add_value(persists(attempt));
+    tensorflow::Feature truncation = tensorflow::Feature();
+    truncation.mutable_float_list()->add_value(truncated);
+    tensorflow::Feature grid_intervals = tensorflow::Feature();
+    grid_intervals.mutable_int64_list()->add_value(M);
+
+    (*feature_map)["generation_of_extinction_probability"] = gen_extinct;
+    (*feature_map)["trait_persists_probability"] = trait_persists;
+    (*feature_map)["number_reinvasions_probability"] = reinvasions;
+    (*feature_map)["truncated_probability"] = truncation;
+    (*feature_map)["pde_grid_intervals"] = grid_intervals;
+  }
+
+}
+
+#endif
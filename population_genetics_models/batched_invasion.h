@@ -0,0 +1,153 @@
+/**
+   @file batched_invasion.h
+   @brief Runs many haploid replicates in lockstep (structure-of-arrays state, vectorised selection step)
+*/
+#ifndef BATCHED_INVASION_H
+#define BATCHED_INVASION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include "Parameters.h"
+#include "absorbing_shortcut.h"
+#include "binomial.h"
+#include "reinvasion_law.h"
+#include "trait_freq.h"
+
+/**
+   @brief Namespace for the batched replicate engine
+   @details The state of fixed_parameters::batch_lanes replicates is held as contiguous arrays of allele A counts,
+   generations and reinvasion numbers. Each generation the expected allele A frequency after selection is computed
+   for all lanes in one vectorisable loop; the lanes are then sampled and checked for extinction, fixation or the
+   max generation. A lane whose replicate is complete is refilled with the next replicate; once no replicates
+   remain, complete lanes are masked out and periodically compacted away.
+*/
+namespace batched_invasion {
+  /** @brief True for the model kernels that the batched engine supports (haploid: a single trait count) */
+  template <class K>
+  struct has_batched_kernel : std::bool_constant<K::Parameters::number_traits == 1> {};
+  /**
+     @brief Structure-of-arrays state for \p W replicates
+  */
+  template <int W>
+  struct Lanes {
+    alignas(64) int count[W]; /**< Number of A alleles */
+    alignas(64) int gen[W]; /**< Current generation (of the current invasion attempt) */
+    alignas(64) int environment[W]; /**< Environment of the step from the current generation */
+    alignas(64) double expectation[W]; /**< Expected frequency of A after selection */
+    int reinvasions[W]; /**< Reinvasion attempt number (-1 during the initial invasion) */
+    int replicate[W]; /**< Index of the replicate in the lane (-1 if the lane is masked out) */
+  };
+  /**
+     @brief Calculates the normalised expected frequency of allele A after selection for lanes [0, n)
+     @details The environment of each lane is looked up first (a table search, for the models with more than one
+     environment), so that K::expectation_in_environment(), which is inlined and has no data-dependent branches,
+     leaves a loop that the compiler vectorises.
+  */
+  template <class K>
+  void expected_allele_freqs(const K &kernel, const int* count, const int* gen, int* environment, double* expectation,
+			     const int n){
+    if constexpr (K::number_environments > 1){
+      for (int i = 0; i < n; i++){
+	environment[i] = kernel.environment(gen[i]);
+      }
+    } else {
+      std::fill(environment, environment + n, 0);
+    }
+#pragma omp simd
+    for (int i = 0; i < n; i++){
+      expectation[i] = kernel.expectation_in_environment(count[i], environment[i]);
+    }
+  }
+  /**
+     @brief Runs \p number_replicates replicates (invasion plus reinvasion attempts) in lockstep
+     @param[in] shortcut Absorbing-state shortcut of \p kernel and \p params (built once per parameter set)
+     @param[out] gen_extinct Generation of extinction of each replicate (max_generations_per_sim if the trait persists)
+     @param[in] law Law of the reinvasion attempts from the fixed state (see reinvasion_law)
+     @param[out] reinvasion_number Number of reinvasions before extinction of each replicate (see record_data)
+     @return Nothing (but fills \p gen_extinct and \p reinvasion_number, indexed by replicate)
+  */
+  template <class K, class R>
+  void run_replicates(const K &kernel, const typename K::Parameters &params,
+		      const absorbing_shortcut::Shortcut<K> &shortcut, R &rng, const int number_replicates,
+		      const reinvasion_law::Law<typename K::Parameters> &law, std::int64_t* gen_extinct,
+		      std::int64_t* reinvasion_number){
+    constexpr int W = fixed_parameters::batch_lanes;
+    Lanes<W> lanes;
+    const int population_size = params.shared.population_size;
+    const int invader_count = trait_freq::invader_count(params);
+    const int max_gen = params.fixed.max_generations_per_sim;
+    int next_replicate = 0;
+    auto start_replicate = [&](const int lane){
+      lanes.count[lane] = invader_count;
+      lanes.gen[lane] = -1;
+      lanes.reinvasions[lane] = -1;
+      lanes.replicate[lane] = next_replicate++;
+    };
+
+    int active = 0; // lanes [0, active) hold replicates (some may be masked out)
+    while (active < W && next_replicate < number_replicates){
+      start_replicate(active++);
+    }
+    int masked = 0;
+    while (active > 0){
+      expected_allele_freqs(kernel, lanes.count, lanes.gen, lanes.environment, lanes.expectation, active);
+      for (int i = 0; i < active; i++){
+	const int replicate = lanes.replicate[i];
+	if (replicate < 0){
+	  continue;
+	}
+	int count = binomial::sample(rng, population_size, lanes.expectation[i]);
+	int gen = ++lanes.gen[i];
+	if (count > 0 && count < population_size && gen < max_gen){
+	  if (!shortcut.absorb(kernel, count, gen)){
+	    lanes.count[i] = count;
+	    continue; // invasion attempt still running
+	  }
+	  lanes.gen[i] = gen;
+	}
+	lanes.count[i] = count;
+	const bool extinct = count == 0;
+	if (lanes.reinvasions[i] == -1){ // initial invasion complete
+	  gen_extinct[replicate] = extinct ? gen : max_gen;
+	}
+	const int remaining = params.shared.number_reinvasions - 1 - lanes.reinvasions[i];
+	if (!extinct && remaining > 0 && law.applies({count})){
+	  // the remaining attempts are independent trials: resisted ones, then (if any are left) the one that is lost
+	  reinvasion_number[replicate] = lanes.reinvasions[i] + law.sample_resisted(rng, remaining) + 1;
+	} else if (!extinct && remaining > 0){
+	  // replace single individual carrying trait of interest with single individual carrying resident trait
+	  lanes.reinvasions[i]++;
+	  lanes.gen[i] = -1;
+	  lanes.count[i] -= invader_count;
+	  continue;
+	} else {
+	  reinvasion_number[replicate] = extinct ? lanes.reinvasions[i] : lanes.reinvasions[i] + 1;
+	}
+	if (next_replicate < number_replicates){
+	  start_replicate(i);
+	} else {
+	  lanes.replicate[i] = -1;
+	  masked++;
+	}
+      }
+      if (4 * masked > active){ // compact: move live lanes to the front
+	int live = 0;
+	for (int i = 0; i < active; i++){
+	  if (lanes.replicate[i] >= 0){
+	    lanes.count[live] = lanes.count[i];
+	    lanes.gen[live] = lanes.gen[i];
+	    lanes.reinvasions[live] = lanes.reinvasions[i];
+	    lanes.replicate[live] = lanes.replicate[i];
+	    live++;
+	  }
+	}
+	active = live;
+	masked = 0;
+      }
+    }
+  }
+
+}
+
+#endif
@@ -0,0 +1,198 @@
+/**
+   @file binomial.h
+   @brief Binomial sampler used by the population genetics models
+*/
+#ifndef BINOMIAL_H
+#define BINOMIAL_H
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+/**
+   @brief Namespace for binomial sampling
+   @details The \p std::binomial_distribution algorithm differs between standard libraries (so a seed gives
+   different replicates under libstdc++ and libc++) and is constructed once per generation, which is costly when
+   the expected count is small. This sampler needs no object and only a few floating point operations of setup
+   per call:
+   - inversion (sequential search from 0) when n * min(p, 1 - p) <= inversion_threshold (the common case for an
+   invading allele at low count)
+   - BTPE (Kachitvichyanukul & Schmeiser 1988) otherwise
+
+   Both use only the raw bits of the engine and <cmath>, so results depend only on the seed.
+*/
+namespace binomial {
+  /** Largest n * min(p, 1 - p) for which inversion is used */
+  inline constexpr double inversion_threshold = 30.0;
+  /**
+     @brief Draws a double uniformly from [0, 1) using the top 53 bits of a 64-bit draw
+  */
+  template <class R>
+  double uniform_01(R &rng){
+    std::uint64_t bits = rng();
+    if constexpr (R::max() == 0xFFFFFFFFULL){ // 32-bit engine: combine two draws
+      bits = (bits << 32) | static_cast<std::uint64_t>(rng());
+    }
+    return static_cast<double>(bits >> 11) * 0x1.0p-53;
+  }
+  /**
+     @brief Inversion sampler for Binomial(n, p) with p <= 0.5 and small n * p
+  */
+  template <class R>
+  int sample_inversion(R &rng, const int n, const double p){
+    const double q = 1.0 - p;
+    const double q_pow_n = std::exp(n * std::log1p(-p));
+    const double ratio = p / q;
+    const double np = n * p;
+    const int bound = static_cast<int>(std::fmin(n, np + 10.0 * std::sqrt(np * q + 1.0)));
+    int x = 0;
+    double px = q_pow_n;
+    double u = uniform_01(rng);
+    while (u > px){
+      x++;
+      if (x > bound){ // numerical underflow in the tail; restart (happens with negligible probability)
+	x = 0;
+	px = q_pow_n;
+	u = uniform_01(rng);
+      } else {
+	u -= px;
+	px *= ratio * (n - x + 1) / x;
+      }
+    }
+    return x;
+  }
+  /**
+     @brief BTPE sampler for Binomial(n, p) with p <= 0.5 and n * p > inversion_threshold
+  */
+  template <class R>
+  int sample_btpe(R &rng, const int n, const double p){
+    const double r = p;
+    const double q = 1.0 - r;
+    const double fm = n * r + r;
+    const int m = static_cast<int>(std::floor(fm));
+    const double nrq = n * r * q;
+    const double p1 = std::floor(2.195 * std::sqrt(nrq) - 4.6 * q) + 0.5;
+    const double xm = m + 0.5;
+    const double xl = xm - p1;
+    const double xr = xm + p1;
+    const double c = 0.134 + 20.5 / (15.3 + m);
+    double a = (fm - xl) / (fm - xl * r);
+    const double laml = a * (1.0 + a / 2.0);
+    a = (xr - fm) / (xr * q);
+    const double lamr = a * (1.0 + a / 2.0);
+    const double p2 = p1 * (1.0 + 2.0 * c);
+    const double p3 = p2 + c / laml;
+    const double p4 = p3 + c / lamr;
+
+    while (true){
+      const double u = uniform_01(rng) * p4;
+      double v = uniform_01(rng);
+      int y;
+      if (u <= p1){ // triangular region: accept immediately
+	return static_cast<int>(std::floor(xm - p1 * v + u));
+      } else if (u <= p2){ // parallelograms
+	const double x = xl + (u - p1) / c;
+	v = v * c + 1.0 - std::fabs(m - x + 0.5) / p1;
+	if (v > 1.0){
+	  continue;
+	}
+	y = static_cast<int>(std::floor(x));
+      } else if (u <= p3){ // left exponential tail
+	if (v == 0.0){
+	  continue;
+	}
+	const double x = std::floor(xl + std::log(v) / laml);
+	if (x < 0.0){
+	  continue;
+	}
+	y = static_cast<int>(x);
+	v = v * (u - p2) * laml;
+      } else { // right exponential tail
+	if (v == 0.0){
+	  continue;
+	}
+	const double x = std::floor(xr - std::log(v) / lamr);
+	if (x > n){
+	  continue;
+	}
+	y = static_cast<int>(x);
+	v = v * (u - p3) * lamr;
+      }
+      const int k = std::abs(y - m);
+      if (k <= 20 || k >= nrq / 2.0 - 1.0){ // explicit evaluation of f(y) / f(m)
+	const double s = r / q;
+	const double a_s = s * (n + 1);
+	double f = 1.0;
+	if (m < y){
+	  for (int i = m + 1; i <= y; i++){
+	    f *= (a_s / i - s);
+	  }
+	} else if (m > y){
+	  for (int i = y + 1; i <= m; i++){
+	    f /= (a_s / i - s);
+	  }
+	}
+	if (v <= f){
+	  return y;
+	}
+	continue;
+      }
+      // squeeze using upper and lower bounds on log(f(y))
+      const double rho = (k / nrq) * ((k * (k / 3.0 + 0.625) + 0.16666666666666666) / nrq + 0.5);
+      const double t = -k * static_cast<double>(k) / (2.0 * nrq);
+      const double log_v = std::log(v);
+      if (log_v < t - rho){
+	return y;
+      }
+      if (log_v > t + rho){
+	continue;
+      }
+      // final acceptance/rejection test (Stirling's formula)
+      const double x1 = y + 1.0;
+      const double f1 = m + 1.0;
+      const double z = n + 1.0 - m;
+      const double w = n - y + 1.0;
+      const double x2 = x1 * x1;
+      const double f2 = f1 * f1;
+      const double z2 = z * z;
+      const double w2 = w * w;
+      const double bound = xm * std::log(f1 / x1) + (n - m + 0.5) * std::log(z / w) +
+	(y - m) * std::log(w * r / (x1 * q)) +
+	(13680. - (462. - (132. - (99. - 140. / f2) / f2) / f2) / f2) / f1 / 166320. +
+	(13680. - (462. - (132. - (99. - 140. / z2) / z2) / z2) / z2) / z / 166320. +
+	(13680. - (462. - (132. - (99. - 140. / x2) / x2) / x2) / x2) / x1 / 166320. +
+	(13680. - (462. - (132. - (99. - 140. / w2) / w2) / w2) / w2) / w / 166320.;
+      if (log_v <= bound){
+	return y;
+      }
+    }
+  }
+  /**
+     @brief Samples from Binomial(\p n, \p p)
+     @param[in, out] rng Random number engine (one of the rng:: engines)
+     @param[in] n Number of trials
+     @param[in] p Probability of success (must be in [0, 1]: the samplers do not terminate for a NaN)
+     @return Number of successes
+  */
+  template <class R>
+  int sample(R &rng, const int n, const double p){
+    assert(p >= 0.0 && p <= 1.0 && "The binomial probability must be in [0, 1]");
+    if (p <= 0.0 || n <= 0){
+      return 0;
+    }
+    if (p >= 1.0){
+      return n;
+    }
+    if (p > 0.5){ // sample failures
+      return n - sample(rng, n, 1.0 - p);
+    }
+    if (n * p <= inversion_threshold){
+      return sample_inversion(rng, n, p);
+    }
+    return sample_btpe(rng, n, p);
+  }
+
+}
+
+#endif
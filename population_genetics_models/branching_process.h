@@ -0,0 +1,146 @@
+/**
+   @file branching_process.h
+   @brief Exact early (small-count) phase of an invasion for the haploid models
+*/
+#ifndef BRANCHING_PROCESS_H
+#define BRANCHING_PROCESS_H
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Parameters.h"
+#include "alias_table.h"
+#include "markov_chain.h"
+#include "trait_freq.h"
+
+/**
+   @brief Namespace for the branching-process engine (--engine=branching)
+   @details While allele A is rare, each A individual leaves a (nearly independent) number of offspring, so its
+   count is a branching process. The distribution of the count is propagated exactly (by iterating the
+   Binomial(N, p_c) transition, whose probability generating function is (1 - p_c + p_c s)^N) while the count is
+   below fixed_parameters::branching_handoff_count. Probability that reaches the threshold is recorded as a
+   handoff (generation, count); the phase ends once the probability still below the threshold is less than
+   fixed_parameters::branching_residual_probability, and that residual is handed off at its current counts.
+
+   Each replicate then draws its outcome of the early phase from an alias table: most are lost while rare and
+   are recorded without simulation; the others continue in the Wright-Fisher simulation from the handoff state.
+   No approximation is involved (apart from the band tolerance of markov_chain::Binomial_Pmf), so the replicates
+   have the same distribution as those of the other engines.
+*/
+namespace branching_process {
+  /** @brief True for the model kernels that the branching-process engine supports (haploid: a single count) */
+  template <class K>
+  struct has_early_phase : std::bool_constant<K::Parameters::number_traits == 1> {};
+  /**
+     @brief Distribution of the outcome of the early phase: (generation, count) with count 0 if the trait was lost
+     in that generation, otherwise the count handed off to the simulation in that generation
+  */
+  template <class K>
+  class Early_Phase {
+  public:
+    Early_Phase(const K &kernel, const typename K::Parameters &params){
+      const int N = params.shared.population_size;
+      const int threshold = std::min(fixed_parameters::branching_handoff_count, N);
+      const int invader_count = trait_freq::invader_count(params);
+      if (invader_count <= 0){ // a replicate that starts without the trait is lost in gen 0
+	add(0, 0, 1.0);
+      } else if (invader_count >= threshold){ // nothing to do before the simulation
+	add(-1, invader_count, 1.0);
+      } else {
+	iterate(kernel, params, threshold, invader_count);
+      }
+      table = alias_table::Alias_Table(probability);
+    }
+    /** @brief Draws the outcome of the early phase of one replicate */
+    template <class R>
+    std::pair<int, int> sample(R &rng) const {
+      const int outcome = table.sample(rng);
+      return {outcome_gen[outcome], outcome_count[outcome]};
+    }
+
+  private:
+    void add(const int gen, const int count, const double outcome_probability){
+      if (outcome_probability > 0.0){
+	outcome_gen.push_back(gen);
+	outcome_count.push_back(count);
+	probability.push_back(outcome_probability);
+      }
+    }
+    /** @brief Propagates the distribution of counts below \p threshold, starting from \p invader_count in gen -1 */
+    void iterate(const K &kernel, const typename K::Parameters &params, const int threshold, const int invader_count){
+      const int N = params.shared.population_size;
+      const int max_gen = params.fixed.max_generations_per_sim;
+      const double log_tolerance = std::log(params.fixed.exact_band_tolerance);
+      const std::vector<double> log_factorial = markov_chain::log_factorials(N);
+      // transition[env][c]: P(c -> lo + k) for k in [0, size), in the environment env
+      std::vector<std::vector<std::pair<int, std::vector<double>>>> transition;
+      std::vector<double> current(threshold, 0.0), next(threshold, 0.0), handoff(N + 1, 0.0);
+      current[invader_count] = 1.0;
+      double rare = 1.0; // P(0 < count < threshold)
+      int gen = 0;
+      for (; gen < max_gen && rare >= fixed_parameters::branching_residual_probability; gen++){
+	// the step into generation gen uses the environment of generation gen - 1 (as in invasion::trait_invasion)
+	const int env = kernel.environment(gen - 1);
+	if (env >= static_cast<int>(transition.size())){
+	  transition.resize(env + 1);
+	}
+	if (transition[env].empty()){
+	  transition[env].resize(threshold);
+	  for (int c = 1; c < threshold; c++){
+	    const markov_chain::Binomial_Pmf pmf(N, kernel.expectation(c, gen - 1), log_factorial);
+	    const auto [lo, hi] = pmf.band(log_tolerance);
+	    transition[env][c].first = lo;
+	    for (int j = lo; j <= hi; j++){
+	      transition[env][c].second.push_back(std::exp(pmf.log_pmf(j)));
+	    }
+	  }
+	}
+	std::fill(next.begin(), next.end(), 0.0);
+	double lost = 0.0;
+	int handoff_lo = N + 1, handoff_hi = -1;
+	for (int c = 1; c < threshold; c++){
+	  if (current[c] <= 0.0){
+	    continue;
+	  }
+	  const auto &[lo, weights] = transition[env][c];
+	  for (int k = 0; k < static_cast<int>(weights.size()); k++){
+	    const int j = lo + k;
+	    const double mass = current[c] * weights[k];
+	    if (j == 0){
+	      lost += mass;
+	    } else if (j < threshold){
+	      next[j] += mass;
+	    } else {
+	      handoff[j] += mass;
+	      handoff_lo = std::min(handoff_lo, j);
+	      handoff_hi = std::max(handoff_hi, j);
+	    }
+	  }
+	}
+	add(gen, 0, lost);
+	for (int j = handoff_lo; j <= handoff_hi; j++){
+	  add(gen, j, handoff[j]);
+	  handoff[j] = 0.0;
+	}
+	current.swap(next);
+	rare = 0.0;
+	for (int c = 1; c < threshold; c++){
+	  rare += current[c];
+	}
+      }
+      for (int c = 1; c < threshold; c++){ // residual: continues in the simulation from generation gen - 1
+	add(gen - 1, c, current[c]);
+      }
+    }
+
+    std::vector<int> outcome_gen;
+    std::vector<int> outcome_count;
+    std::vector<double> probability;
+    alias_table::Alias_Table table;
+  };
+
+}
+
+#endif
@@ -4,75 +4,421 @@
 #ifndef CONDITIONAL_EXISTENCE_PROBABILITY_H
 #define CONDITIONAL_EXISTENCE_PROBABILITY_H
 
+#include <array>
 #include <vector>
-#include <random>
 #include <numeric>
+#include <algorithm>
+#include <cstdint>
+#include <string>
 #include "trait_invasion.h"
 #include "conditional_existence_status.h"
 #include "trait_freq.h"
 #include "include/example.pb.h"
 #include "record_data.h"
+#include "thread_pool.h"
+#include "rng.h"
+#include "run_options.h"
+#include "batched_invasion.h"
+#include "ensemble_invasion.h"
+#include "alias_table.h"
+#include "branching_process.h"
+#include "genotype_coupling.h"
+#include "reinvasion_law.h"
+#include "sequential_stopping.h"
 
 namespace conditional_existence_probability {
-  
+
+  /**
+     @brief Number of chunks needed to cover \p number_replicates
+  */
+  template <class P>
+  int number_chunks(const P &params, const int number_replicates){
+    return (number_replicates + params.fixed.replicates_per_chunk - 1) / params.fixed.replicates_per_chunk;
+  }
+  /**
+     @brief Returns the add_chunk of sequential_stopping::run_chunks() for records kept per chunk
+  */
+  inline auto add_chunk(const std::vector<tensorflow::Int64List> &chunk_gen_extinct,
+			const std::vector<tensorflow::Int64List> &chunk_reinvasion_number){
+    return [&chunk_gen_extinct, &chunk_reinvasion_number](int chunk, sequential_stopping::Monitor &monitor){
+      monitor.add(chunk_gen_extinct[chunk].value().data(), chunk_reinvasion_number[chunk].value().data(),
+		  chunk_gen_extinct[chunk].value_size());
+    };
+  }
+  /**
+     @brief Records the outcome of the initial invasion of a replicate (which ended in generation \p gen with
+     \p trait_count), then runs (up to number_reinvasions) reinvasion attempts and records their outcome
+     @details Attempts from the fixed state are sampled from \p law when it applies (see reinvasion_law)
+     @return Nothing (but appends one value to each of \p gen_extinct and \p reinvasion_number)
+  */
+  template <class K, class R>
+  void record_and_reinvade(const K &kernel, const typename K::Parameters &params,
+			   const invasion::Shortcuts<K> &shortcuts, R &rng,
+			   trait_freq::trait_counts<typename K::Parameters> &trait_count, int gen,
+			   const reinvasion_law::Law<typename K::Parameters> &law, tensorflow::Int64List* gen_extinct,
+			   tensorflow::Int64List* reinvasion_number){
+    int reinvasions = -1;
+    // record conditional existence status of trait
+    record_data::generation_trait_extinction(gen_extinct, trait_count, params, gen);
+    // run reinvasion attempts by resident while trait remains (if number_reinvasions is non-zero)
+    while (!conditional_existence_status::trait_extinct(trait_count, params) &&
+	   reinvasions < params.shared.number_reinvasions - 1){
+      if (law.applies(trait_count)){
+	// the remaining attempts are independent trials: resisted ones, then (if any are left) the one that is lost
+	const int remaining = params.shared.number_reinvasions - 1 - reinvasions;
+	const int resisted = law.sample_resisted(rng, remaining);
+	reinvasions += resisted;
+	if (resisted < remaining){
+	  reinvasions++;
+	  trait_count.fill(0);
+	}
+	break;
+      }
+      gen = -1;
+      reinvasions++;
+      // replace single individual carrying trait of interest with single individual carrying resident trait
+      trait_count[ params.shared.trait_info[0] ] -= trait_freq::invader_count(params);
+      // run simulation to see whether trait resists invasion
+      invasion::trait_invasion(kernel, params, shortcuts, rng, trait_count, gen);
+    }
+    record_data::number_reinvasions_before_extinction(reinvasion_number, trait_count, params, reinvasions);
+  }
+  /**
+     @brief Runs a single replicate: an invasion followed by (up to number_reinvasions) reinvasion attempts
+     @return Nothing (but appends one value to each of \p gen_extinct and \p reinvasion_number)
+  */
+  template <class K, class R>
+  void run_replicate(const K &kernel, const typename K::Parameters &params, const invasion::Shortcuts<K> &shortcuts,
+		     R &rng, const reinvasion_law::Law<typename K::Parameters> &law, tensorflow::Int64List* gen_extinct,
+		     tensorflow::Int64List* reinvasion_number){
+    trait_freq::trait_counts<typename K::Parameters> trait_count = trait_freq::initialise_trait_counts(params);
+    int gen = -1;
+    // run simulation to see whether trait invades and either becomes fixed or withstands the max gens
+    invasion::trait_invasion(kernel, params, shortcuts, rng, trait_count, gen);
+    record_and_reinvade(kernel, params, shortcuts, rng, trait_count, gen, law, gen_extinct, reinvasion_number);
+  }
+  /**
+     @brief Runs a single replicate whose early phase is drawn from \p early_phase (see branching_process)
+     @details Replicates lost in the early phase are recorded without simulation; the others continue the
+     invasion from the handoff state.
+  */
+  template <class K, class R>
+  void run_replicate(const K &kernel, const typename K::Parameters &params, const invasion::Shortcuts<K> &shortcuts,
+		     R &rng, const branching_process::Early_Phase<K> &early_phase,
+		     const reinvasion_law::Law<typename K::Parameters> &law,
+		     tensorflow::Int64List* gen_extinct, tensorflow::Int64List* reinvasion_number){
+    const auto [handoff_gen, handoff_count] = early_phase.sample(rng);
+    trait_freq::trait_counts<typename K::Parameters> trait_count {handoff_count};
+    int gen = handoff_gen;
+    if (!conditional_existence_status::allele_A_extinct(trait_count, params) &&
+	!conditional_existence_status::allele_A_fixed(trait_count, params)){
+      invasion::trait_invasion(kernel, params, shortcuts, rng, trait_count, gen);
+    }
+    record_and_reinvade(kernel, params, shortcuts, rng, trait_count, gen, law, gen_extinct, reinvasion_number);
+  }
+  /**
+     @brief Runs one replicate for each DSE trait (AA with \p params_AA, Aa with \p params_Aa), sharing the
+     trajectory of the initial invasion when the coupled generation-0 states are equal (see genotype_coupling)
+     @return Nothing (but appends one value to each of the lists of both traits)
+  */
+  template <class K, class R>
+  void run_replicate(const K &kernel, const typename K::Parameters &params_AA,
+		     const typename K::Parameters &params_Aa, const invasion::Shortcuts<K> &shortcuts_AA,
+		     const invasion::Shortcuts<K> &shortcuts_Aa, R &rng,
+		     const genotype_coupling::First_Generation<K> &first_generation,
+		     const reinvasion_law::Law<typename K::Parameters> &law_AA,
+		     const reinvasion_law::Law<typename K::Parameters> &law_Aa,
+		     tensorflow::Int64List* gen_extinct_AA, tensorflow::Int64List* reinvasion_number_AA,
+		     tensorflow::Int64List* gen_extinct_Aa, tensorflow::Int64List* reinvasion_number_Aa){
+    auto [trait_count_AA, trait_count_Aa, shared] = first_generation.sample(rng);
+    // continues an initial invasion from its state in generation 0 (unless it already ended)
+    auto continue_invasion = [&](trait_freq::trait_counts<typename K::Parameters> &trait_count,
+				 const typename K::Parameters &params, const invasion::Shortcuts<K> &shortcuts){
+      int gen = 0;
+      if (!conditional_existence_status::allele_A_extinct(trait_count, params) &&
+	  !conditional_existence_status::allele_A_fixed(trait_count, params)){
+	invasion::trait_invasion(kernel, params, shortcuts, rng, trait_count, gen);
+      }
+      return gen;
+    };
+    const int gen_AA = continue_invasion(trait_count_AA, params_AA, shortcuts_AA);
+    int gen_Aa = gen_AA;
+    if (shared){
+      trait_count_Aa = trait_count_AA;
+    } else {
+      gen_Aa = continue_invasion(trait_count_Aa, params_Aa, shortcuts_Aa);
+    }
+    record_and_reinvade(kernel, params_AA, shortcuts_AA, rng, trait_count_AA, gen_AA, law_AA, gen_extinct_AA,
+			reinvasion_number_AA);
+    record_and_reinvade(kernel, params_Aa, shortcuts_Aa, rng, trait_count_Aa, gen_Aa, law_Aa, gen_extinct_Aa,
+			reinvasion_number_Aa);
+  }
+
+  /**
+     @brief Runs the QEF replicates of a haploid model with the batched (lockstep) engine
+     @details Uses the same chunks and per-chunk streams as calculate(); within a chunk the replicates are run
+     by batched_invasion::run_replicates().
+  */
+  template <class K, class R>
+  void calculate_batched(const K &kernel, const typename K::Parameters &params, R &rng,
+			 const reinvasion_law::Law<typename K::Parameters> &law, tensorflow::Int64List* gen_extinct,
+			 tensorflow::Int64List* reinvasion_number){
+
+    const int number_replicates = params.fixed.number_replicates_QEF;
+    const int chunks = number_chunks(params, number_replicates);
+    std::vector<R> chunk_rng = rng::make_streams(rng, chunks);
+    std::vector<std::int64_t> all_gen_extinct(number_replicates);
+    std::vector<std::int64_t> all_reinvasion_number(number_replicates);
+    const absorbing_shortcut::Shortcut<K> shortcut(kernel, params);
+
+    const auto chunk_range = [&](const int chunk){
+      const int first = chunk * params.fixed.replicates_per_chunk;
+      return std::array<int, 2> {first, std::min(first + params.fixed.replicates_per_chunk, number_replicates)};
+    };
+    const int chunks_run = sequential_stopping::run_chunks(params, chunks, params.fixed.replicates_per_chunk, [&](int chunk){
+      const auto [first, last] = chunk_range(chunk);
+      batched_invasion::run_replicates(kernel, params, shortcut, chunk_rng[chunk], last - first, law,
+				       all_gen_extinct.data() + first, all_reinvasion_number.data() + first);
+    }, [&](int chunk, sequential_stopping::Monitor &monitor){
+      const auto [first, last] = chunk_range(chunk);
+      monitor.add(all_gen_extinct.data() + first, all_reinvasion_number.data() + first, last - first);
+    });
+    const int replicates_run = chunk_range(chunks_run - 1)[1];
+    gen_extinct->mutable_value()->Add(all_gen_extinct.begin(), all_gen_extinct.begin() + replicates_run);
+    reinvasion_number->mutable_value()->Add(all_reinvasion_number.begin(), all_reinvasion_number.begin() + replicates_run);
+  }
+
+  /**
+     @brief Runs the QEF replicates of a haploid model with the ensemble engine
+     @details Replicates are split into fixed chunks of params.fixed.replicates_per_ensemble, each run as one
+     ensemble (ensemble_invasion::run_replicates()) with its own stream of \p rng.
+  */
+  template <class K, class R>
+  void calculate_ensemble(const K &kernel, const typename K::Parameters &params, R &rng,
+			  tensorflow::Int64List* gen_extinct, tensorflow::Int64List* reinvasion_number){
+
+    const int number_replicates = params.fixed.number_replicates_QEF;
+    const int chunks = (number_replicates + params.fixed.replicates_per_ensemble - 1) /
+      params.fixed.replicates_per_ensemble;
+    std::vector<R> chunk_rng = rng::make_streams(rng, chunks);
+    std::vector<std::int64_t> all_gen_extinct(number_replicates);
+    std::vector<std::int64_t> all_reinvasion_number(number_replicates);
+
+    const auto chunk_range = [&](const int chunk){
+      const int first = chunk * params.fixed.replicates_per_ensemble;
+      return std::array<int, 2> {first, std::min(first + params.fixed.replicates_per_ensemble, number_replicates)};
+    };
+    const int chunks_run = sequential_stopping::run_chunks(params, chunks, params.fixed.replicates_per_ensemble, [&](int chunk){
+      const auto [first, last] = chunk_range(chunk);
+      ensemble_invasion::run_replicates(kernel, params, chunk_rng[chunk], last - first,
+					all_gen_extinct.data() + first, all_reinvasion_number.data() + first);
+    }, [&](int chunk, sequential_stopping::Monitor &monitor){
+      const auto [first, last] = chunk_range(chunk);
+      monitor.add(all_gen_extinct.data() + first, all_reinvasion_number.data() + first, last - first);
+    });
+    const int replicates_run = chunk_range(chunks_run - 1)[1];
+    gen_extinct->mutable_value()->Add(all_gen_extinct.begin(), all_gen_extinct.begin() + replicates_run);
+    reinvasion_number->mutable_value()->Add(all_reinvasion_number.begin(), all_reinvasion_number.begin() + replicates_run);
+  }
+
+  /**
+     @brief Runs the QEF replicates of a haploid model with the branching-process engine
+     @details The exact early phase (branching_process::Early_Phase) is calculated once; replicates then use the
+     same chunks and per-chunk streams as calculate(), and only those that survive the early phase are simulated.
+  */
+  template <class K, class R>
+  void calculate_branching(const K &kernel, const typename K::Parameters &params, R &rng,
+			   const reinvasion_law::Law<typename K::Parameters> &law, tensorflow::Int64List* gen_extinct,
+			   tensorflow::Int64List* reinvasion_number){
+
+    const int number_replicates = params.fixed.number_replicates_QEF;
+    const int chunks = number_chunks(params, number_replicates);
+    std::vector<R> chunk_rng = rng::make_streams(rng, chunks);
+    std::vector<tensorflow::Int64List> chunk_gen_extinct(chunks);
+    std::vector<tensorflow::Int64List> chunk_reinvasion_number(chunks);
+    const branching_process::Early_Phase<K> early_phase(kernel, params);
+    const invasion::Shortcuts<K> shortcuts(kernel, params);
+
+    const int chunks_run = sequential_stopping::run_chunks(params, chunks, params.fixed.replicates_per_chunk, [&](int chunk){
+      const int first = chunk * params.fixed.replicates_per_chunk;
+      const int last = std::min(first + params.fixed.replicates_per_chunk, number_replicates);
+      for (int i = first; i < last; i++){
+	run_replicate(kernel, params, shortcuts, chunk_rng[chunk], early_phase, law, &chunk_gen_extinct[chunk],
+		      &chunk_reinvasion_number[chunk]);
+      }
+    }, add_chunk(chunk_gen_extinct, chunk_reinvasion_number));
+    // merge in replicate order
+    gen_extinct->mutable_value()->Reserve(number_replicates);
+    reinvasion_number->mutable_value()->Reserve(number_replicates);
+    for (int chunk = 0; chunk < chunks_run; chunk++){
+      gen_extinct->MergeFrom(chunk_gen_extinct[chunk]);
+      reinvasion_number->MergeFrom(chunk_reinvasion_number[chunk]);
+    }
+  }
+
   /**
      @brief Template function to run replicates and calculate conditional existence probability for the pop gen models
+     @details Replicates are split into chunks of params.fixed.replicates_per_chunk that are run on the thread
+     pool. Chunk c always covers the same replicates and uses stream c of \p rng, and each chunk records into its
+     own buffers, which are then appended to \p gen_extinct and \p reinvasion_number in replicate order. The
+     output therefore does not depend on the number of threads. Haploid models use calculate_batched() by default,
+     calculate_ensemble() with --engine=ensemble, calculate_branching() with --engine=branching, and the
+     per-replicate loop below with --engine=scalar. With --sampler=alias the per-replicate loops are run with the
+     kernel wrapped in alias_table::Tabulated_Kernel (the ensemble engine samples whole bands, so it ignores the
+     sampler). With --precision or --relative_precision every engine stops after the first block of chunks at
+     which the persistence probabilities are precise enough (see sequential_stopping).
+     @param[in] kernel Model kernel (one of HSE::Kernel, HTE::Kernel, DSE::Kernel, or HTEOE::Kernel)
      @param[in] params Template for HSE_Model_Parameters, DSE_Model_Parameters, HTE_Model_Parameters, or HTEOE_Model_Parameters
-     @param[in] fitnesses Vector of allele or genotype fitnesses
-     @param[in, out] rng Random number generator
-     @param[in] calculate_trait_freqs Template for method to calcluate trait frequency (one of HSE::calculate_trait_freqs, HTE::calculate_trait_freqs, DSE::calculate_trait_freqs, or HTEOE::calculate_trait_freqs)
-     @return Nothing (but modifies \p data)
+     @param[in, out] rng Random number engine (the root of the per-chunk streams)
+     @param[in] law Law of the reinvasion attempts from the fixed state (reinvasion_law::calculate; not used by the
+     ensemble engine)
+     @return Name of the engine that ran (batched, ensemble, branching, or scalar), which --engine does not always
+     give (e.g. the default, batched, runs per replicate for DSE or with --sampler=alias)
   */
-  template <class P, class F>
-  void calculate(const P &params, std::mt19937 &rng, const std::vector<double> &fitnesses,
-		 F calculate_trait_freqs, tensorflow::Int64List* gen_extinct, tensorflow::Int64List* reinvasion_number){
-
-    for (int i = 0; i < params.fixed.number_replicates_QEF; i++){
-      std::vector<double> trait_freq = trait_freq::initialise_trait_freq(params);
-      int reinvasions = -1;
-      int gen = -1;
-      // run simulation to see whether trait invades and either becomes fixed or withstands the max gens
-      invasion::trait_invasion(fitnesses, params, rng, trait_freq, calculate_trait_freqs, gen);
-      // record conditional existence status of trait
-      record_data::generation_trait_extinction(gen_extinct, trait_freq, params, gen);
-      // run reinvasion attempts by resident while trait remains (if number_reinvasions is non-zero)
-      while (!conditional_existence_status::trait_extinct(trait_freq, params) &&
-	     reinvasions < params.shared.number_reinvasions - 1){
-	gen = -1;
-	reinvasions++;
-	// replace single individual carrying trait of interest with single individual carrying resident trait
-	trait_freq[ params.shared.trait_info[0] ] -= params.shared.initial_trait_freq;
-	// run simulation to see whether trait resists invasion
-	invasion::trait_invasion(fitnesses, params, rng, trait_freq, calculate_trait_freqs, gen);
+  template <class K, class R>
+  std::string calculate(const K &kernel, const typename K::Parameters &params, R &rng,
+			const reinvasion_law::Law<typename K::Parameters> &law, tensorflow::Int64List* gen_extinct,
+			tensorflow::Int64List* reinvasion_number){
+
+    const run_options::Run_Options &options = run_options::get();
+    if constexpr (batched_invasion::has_batched_kernel<K>::value){
+      if (options.engine.compare("batched") == 0 && options.sampler.compare("alias") != 0){
+	calculate_batched(kernel, params, rng, law, gen_extinct, reinvasion_number);
+	return "batched";
+      } else if (options.engine.compare("ensemble") == 0){
+	calculate_ensemble(kernel, params, rng, gen_extinct, reinvasion_number);
+	return "ensemble";
+      }
+    }
+    if constexpr (!alias_table::is_tabulated<K>::value){
+      if (options.sampler.compare("alias") == 0){
+	return calculate(alias_table::Tabulated_Kernel<K>(kernel, params), params, rng, law, gen_extinct,
+			 reinvasion_number);
+      }
+    }
+    if constexpr (branching_process::has_early_phase<K>::value){
+      if (options.engine.compare("branching") == 0){
+	calculate_branching(kernel, params, rng, law, gen_extinct, reinvasion_number);
+	return "branching";
+      }
+    }
+    const int number_replicates = params.fixed.number_replicates_QEF;
+    const int chunks = number_chunks(params, number_replicates);
+    std::vector<R> chunk_rng = rng::make_streams(rng, chunks);
+    std::vector<tensorflow::Int64List> chunk_gen_extinct(chunks);
+    std::vector<tensorflow::Int64List> chunk_reinvasion_number(chunks);
+    const invasion::Shortcuts<K> shortcuts(kernel, params);
+
+    const int chunks_run = sequential_stopping::run_chunks(params, chunks, params.fixed.replicates_per_chunk, [&](int chunk){
+      const int first = chunk * params.fixed.replicates_per_chunk;
+      const int last = std::min(first + params.fixed.replicates_per_chunk, number_replicates);
+      for (int i = first; i < last; i++){
+	run_replicate(kernel, params, shortcuts, chunk_rng[chunk], law, &chunk_gen_extinct[chunk],
+		      &chunk_reinvasion_number[chunk]);
+      }
+    }, add_chunk(chunk_gen_extinct, chunk_reinvasion_number));
+    // merge in replicate order
+    gen_extinct->mutable_value()->Reserve(number_replicates);
+    reinvasion_number->mutable_value()->Reserve(number_replicates);
+    for (int chunk = 0; chunk < chunks_run; chunk++){
+      gen_extinct->MergeFrom(chunk_gen_extinct[chunk]);
+      reinvasion_number->MergeFrom(chunk_reinvasion_number[chunk]);
+    }
+    return "scalar";
+  }
+  /**
+     @brief Runs the QEF replicates of both DSE traits in one pass (--traits=both; see genotype_coupling)
+     @details Uses the same chunks and per-chunk streams as calculate(); replicate i of each trait is recorded in
+     replicate order in the lists of that trait.
+     @param[in] params_AA Parameters with the homozygote AA as the trait of interest (params_Aa: the heterozygote)
+  */
+  template <class K, class R>
+  void calculate_both_traits(const K &kernel, const typename K::Parameters &params_AA,
+			     const typename K::Parameters &params_Aa, R &rng,
+			     const reinvasion_law::Law<typename K::Parameters> &law_AA,
+			     const reinvasion_law::Law<typename K::Parameters> &law_Aa,
+			     tensorflow::Int64List* gen_extinct_AA, tensorflow::Int64List* reinvasion_number_AA,
+			     tensorflow::Int64List* gen_extinct_Aa, tensorflow::Int64List* reinvasion_number_Aa){
+
+    if constexpr (!alias_table::is_tabulated<K>::value){
+      if (run_options::get().sampler.compare("alias") == 0){
+	calculate_both_traits(alias_table::Tabulated_Kernel<K>(kernel, params_AA), params_AA, params_Aa, rng, law_AA,
+			      law_Aa, gen_extinct_AA, reinvasion_number_AA, gen_extinct_Aa, reinvasion_number_Aa);
+	return;
+      }
+    }
+    const int number_replicates = params_AA.fixed.number_replicates_QEF;
+    const int chunks = number_chunks(params_AA, number_replicates);
+    std::vector<R> chunk_rng = rng::make_streams(rng, chunks);
+    // per chunk: generation of extinction and number of reinvasions of AA, then of Aa
+    std::vector<std::array<tensorflow::Int64List, 4>> chunk_lists(chunks);
+    const genotype_coupling::First_Generation<K> first_generation(kernel, params_AA);
+    const invasion::Shortcuts<K> shortcuts_AA(kernel, params_AA), shortcuts_Aa(kernel, params_Aa);
+
+    thread_pool::get_pool().parallel_for(chunks, [&](int chunk){
+      const int first = chunk * params_AA.fixed.replicates_per_chunk;
+      const int last = std::min(first + params_AA.fixed.replicates_per_chunk, number_replicates);
+      std::array<tensorflow::Int64List, 4> &lists = chunk_lists[chunk];
+      for (int i = first; i < last; i++){
+	run_replicate(kernel, params_AA, params_Aa, shortcuts_AA, shortcuts_Aa, chunk_rng[chunk], first_generation,
+		      law_AA, law_Aa, &lists[0], &lists[1], &lists[2], &lists[3]);
+      }
+    });
+    // merge in replicate order
+    std::array<tensorflow::Int64List*, 4> all_lists {gen_extinct_AA, reinvasion_number_AA, gen_extinct_Aa,
+      reinvasion_number_Aa};
+    for (int list = 0; list < 4; list++){
+      all_lists[list]->mutable_value()->Reserve(number_replicates);
+      for (int chunk = 0; chunk < chunks; chunk++){
+	all_lists[list]->MergeFrom(chunk_lists[chunk][list]);
       }
-      record_data::number_reinvasions_before_extinction(reinvasion_number, trait_freq, params, reinvasions);
     }
   }
-  // overloaded method for LSTM scenario
-  template <class P, class F>
-  void calculate(const P &params, std::mt19937 &rng, const std::vector<double> &fitnesses,
-		 F calculate_trait_freqs, tensorflow::Int64List* gen_extinct, tensorflow::FeatureList &featurelist){
-
-    for (int i = 0; i < params.fixed.number_replicates_LSTM; i++){
-      std::vector<double> trait_freq = trait_freq::initialise_trait_freq(params);
-      int gen = -1;
-      tensorflow::Feature* raw_trait_frequencies = featurelist.add_feature();
-      tensorflow::FloatList* raw_trait_freq = raw_trait_frequencies->mutable_float_list();
-      // run replicate, record raw_trait_freq
-      invasion::trait_invasion(fitnesses, params, rng, trait_freq, calculate_trait_freqs, gen, raw_trait_freq);
-      // record conditional existence status of trait
-      record_data::generation_trait_extinction(gen_extinct, trait_freq, params, gen);
+  // overloaded method for LSTM scenario (raw_trait_freq is recorded for the first number_replicates_LSTM replicates;
+  // the replicates always run per replicate, so the engine returned is scalar)
+  template <class K, class R>
+  std::string calculate(const K &kernel, const typename K::Parameters &params, R &rng,
+			tensorflow::Int64List* gen_extinct, tensorflow::FeatureList &featurelist){
+
+    if constexpr (!alias_table::is_tabulated<K>::value){
+      if (run_options::get().sampler.compare("alias") == 0){
+	return calculate(alias_table::Tabulated_Kernel<K>(kernel, params), params, rng, gen_extinct, featurelist);
+      }
     }
 
-    for (int i = 0; i < params.fixed.number_replicates_QEF - params.fixed.number_replicates_LSTM; i++){
-      std::vector<double> trait_freq = trait_freq::initialise_trait_freq(params);
-      int gen = -1;
-      // run replicate, don't record raw_trait_freq
-      invasion::trait_invasion(fitnesses, params, rng, trait_freq, calculate_trait_freqs, gen);
-      // record conditional existence status of trait
-      record_data::generation_trait_extinction(gen_extinct, trait_freq, params, gen);
+    const int number_replicates = params.fixed.number_replicates_QEF;
+    const int chunks = number_chunks(params, number_replicates);
+    std::vector<R> chunk_rng = rng::make_streams(rng, chunks);
+    std::vector<tensorflow::Int64List> chunk_gen_extinct(chunks);
+    std::vector<tensorflow::FeatureList> chunk_featurelist(chunks);
+    const invasion::Shortcuts<K> shortcuts(kernel, params);
+
+    thread_pool::get_pool().parallel_for(chunks, [&](int chunk){
+      const int first = chunk * params.fixed.replicates_per_chunk;
+      const int last = std::min(first + params.fixed.replicates_per_chunk, number_replicates);
+      for (int i = first; i < last; i++){
+	trait_freq::trait_counts<typename K::Parameters> trait_count = trait_freq::initialise_trait_counts(params);
+	int gen = -1;
+	if (i < params.fixed.number_replicates_LSTM){
+	  tensorflow::Feature* raw_trait_frequencies = chunk_featurelist[chunk].add_feature();
+	  tensorflow::FloatList* raw_trait_freq = raw_trait_frequencies->mutable_float_list();
+	  // run replicate, record raw_trait_freq
+	  invasion::trait_invasion(kernel, params, chunk_rng[chunk], trait_count, gen, raw_trait_freq);
+	} else {
+	  // run replicate, don't record raw_trait_freq
+	  invasion::trait_invasion(kernel, params, shortcuts, chunk_rng[chunk], trait_count, gen);
+	}
+	// record conditional existence status of trait
+	record_data::generation_trait_extinction(&chunk_gen_extinct[chunk], trait_count, params, gen);
+      }
+    });
+    // merge in replicate order
+    gen_extinct->mutable_value()->Reserve(number_replicates);
+    for (int chunk = 0; chunk < chunks; chunk++){
+      gen_extinct->MergeFrom(chunk_gen_extinct[chunk]);
+      featurelist.MergeFrom(chunk_featurelist[chunk]);
     }
-  
+    return "scalar";
   }
 
 }
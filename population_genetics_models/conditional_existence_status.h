@@ -4,56 +4,54 @@
 #ifndef CONDITIONAL_EXISTENCE_STATUS_H
 #define CONDITIONAL_EXISTENCE_STATUS_H
 
-#include <vector>
-#include <numeric>
+#include <array>
+#include <cstddef>
+#include "trait_freq.h"
 
 /**
    @brief Namespace for functions that determine whether a trait persists in the population
 **/
 namespace conditional_existence_status {
-
-  bool close_to_value(const double trait_freq, const double value, const double tolerance);
-  double get_allele_A_freq(const std::vector<double> &trait_freq);
-
   /**
-     @brief Checks whether allele A freq is equal to 0
-     @param[in] trait_freq Vector storing allele A freq (if haploid) or AA and Aa genotype freq (if diploid)
-     @param[in] params.fixed.tolerance Tolerance for comparison of doubles
-     @return True if allele A freq is equal to 0; false otherwise
+     @brief Number of copies of allele A (haploid: #A; diploid: 2 * #AA + #Aa)
+  */
+  template <std::size_t K>
+  int allele_A_copies(const std::array<int, K> &trait_count){
+    if constexpr (K == 1){
+      return trait_count[0];
+    } else {
+      return 2 * trait_count[0] + trait_count[1];
+    }
+  }
+  /**
+     @brief Checks whether allele A is absent
+     @param[in] trait_count Number of A individuals (if haploid) or AA and Aa individuals (if diploid)
+     @return True if there are no copies of allele A; false otherwise
   */
   template<class T>
-  bool allele_A_extinct(const std::vector<double> &trait_freq, const T &params){
-    double allele_A_frequency = get_allele_A_freq(trait_freq);
-    bool allele_A_is_extinct = close_to_value(allele_A_frequency, 0.0, params.fixed.tolerance);
-    bool allele_A_negative_value = allele_A_frequency < 0.0; // shouldn't happen but to be extra sure
-    return allele_A_is_extinct || allele_A_negative_value;
+  bool allele_A_extinct(const trait_freq::trait_counts<T> &trait_count, const T &params){
+    return allele_A_copies(trait_count) <= 0;
   }
   /**
-     @brief Checks whether trait freq is equal to 0
-     @param[in] trait_freq Vector storing allele A freq (if haploid) or AA and Aa genotype freq (if diploid)
-     @param[in] params.fixed.tolerance Tolerance for comparison of doubles
-     @param[in] params.shared.trait_info Contains index of our trait of interest (in \p trait_freq)
-     @return True if trait freq is equal to 0; false otherwise
+     @brief Checks whether the trait is absent
+     @param[in] trait_count Number of A individuals (if haploid) or AA and Aa individuals (if diploid)
+     @param[in] params.shared.trait_info Contains index of our trait of interest (in \p trait_count)
+     @return True if no individual carries the trait; false otherwise
   */
   template<class T>
-  bool trait_extinct(const std::vector<double> &trait_freq, const T &params){
-    double trait_frequency = trait_freq[params.shared.trait_info[0]];
-    bool trait_is_extinct = close_to_value(trait_frequency, 0.0, params.fixed.tolerance);
-    bool trait_negative_value = trait_frequency < 0.0; // shouldn't happen but to be extra sure
-    return trait_is_extinct || trait_negative_value;
+  bool trait_extinct(const trait_freq::trait_counts<T> &trait_count, const T &params){
+    return trait_count[params.shared.trait_info[0]] <= 0;
   }
   /**
-     @brief Checks whether allele A freq is equal to 1
-     @param[in] trait_freq Vector storing allele A freq (if haploid) or AA and Aa genotype freq (if diploid)
-     @param[in] params.fixed.tolerance Tolerance for comparison of doubles
-     @return True if allele A freq is equal to 1; false otherwise
+     @brief Checks whether allele A is fixed
+     @param[in] trait_count Number of A individuals (if haploid) or AA and Aa individuals (if diploid)
+     @param[in] params.shared.population_size Number of individuals in the population
+     @return True if every allele in the population is A; false otherwise
   */
   template<class T>
-  bool allele_A_fixed(const std::vector<double> &trait_freq, const T &params){
-    double allele_A_frequency = get_allele_A_freq(trait_freq);
-    bool allele_A_is_fixed = close_to_value(allele_A_frequency, 1.0, params.fixed.tolerance);
-    bool allele_A_exceeds_one = allele_A_frequency > 1.0; // shouldn't happen but to be extra sure
-    return allele_A_is_fixed || allele_A_exceeds_one;
+  bool allele_A_fixed(const trait_freq::trait_counts<T> &trait_count, const T &params){
+    // total number of alleles is N (haploid) or 2N (diploid)
+    return allele_A_copies(trait_count) >= T::ploidy * params.shared.population_size;
   }
   /**
      @brief Checks whether simulation has reached the max number of generations
@@ -62,7 +60,7 @@ namespace conditional_existence_status {
      @return True if simulation has reached the max number of generations; false otherwise
   */
   template<class T>
-  bool reached_max_gen(const double gen, const T &params){
+  bool reached_max_gen(const int gen, const T &params){
     return gen >= params.fixed.max_generations_per_sim;
   }
 
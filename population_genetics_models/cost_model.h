@@ -0,0 +1,122 @@
+/**
+   @file cost_model.h
+   @brief Estimates the run time of a parameter point from a short pilot run (used to schedule sweeps)
+*/
+#ifndef COST_MODEL_H
+#define COST_MODEL_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "include/example.pb.h"
+#include "Parameters.h"
+#include "conditional_existence_status.h"
+#include "environment_schedule.h"
+#include "markov_chain.h"
+#include "reinvasion_law.h"
+#include "rng.h"
+#include "run_options.h"
+#include "trait_freq.h"
+#include "trait_invasion.h"
+
+/**
+   @brief Namespace for the cost model of a parameter point
+   @details The cost of a point is estimated from a pilot of its own kernel, so N, the selection coefficients, the
+   model (and its environment schedule) enter through the generations that invasion::trait_invasion takes. The pilot
+   runs up to fixed_parameters::cost_pilot_replicates invasions (stopping once they take
+   fixed_parameters::cost_pilot_seconds), plus one reinvasion attempt after each invasion that ends with the trait
+   fixed. The estimate of one replicate is then
+
+   t_invasion + P(fixed) * a * t_attempt
+
+   where a is number_reinvasions if the reinvasions are simulated and 1 if they are sampled in closed form. Which
+   of the two applies is decided as in reinvasion_law::calculate, from the attempts that the replicates would
+   simulate (estimated from P(fixed) of the pilot). The cost of the point is that times the number of replicates,
+   plus the law once: fixed_parameters::reinvasion_gate_replicates replicates, and then either the exact
+   calculation at its work budget (the time of the attempts it replaces) or the
+   fixed_parameters::reinvasion_pilot_attempts attempts of the pilot. An LSTM point runs as many
+   replicates as a QEF point and records the trait frequencies of the first number_replicates_LSTM of them, so
+   every other pilot invasion of such a point records them too and prices t_invasion of those replicates. The
+   estimate is meant for ordering the points of a sweep, not as a timing: engines other than the per-replicate
+   ones are estimated the same way.
+*/
+namespace cost_model {
+  /**
+     @brief Estimates the run time of a parameter point on one thread
+     @param[in] number_replicates Number of replicates of the point (for each of its runs)
+     @param[in] number_runs Number of runs sharing the replicates (e.g. the switch generations of an HTE sweep)
+     @param[in] seed Seed of the pilot (its draws are not used by the point)
+     @param[in] number_recorded Number of the replicates whose trait frequencies are recorded (LSTM)
+     @return Estimated time in seconds
+  */
+  template <class K>
+  double estimate(const K &kernel, const typename K::Parameters &params, const int number_replicates,
+		  const int number_runs, const std::uint64_t seed, const int number_recorded = 0){
+    using P = typename K::Parameters;
+    using clock = std::chrono::steady_clock;
+    const run_options::Run_Options &options = run_options::get();
+    double invasion_seconds = 0.0;
+    double recorded_seconds = 0.0;
+    double attempt_seconds = 0.0;
+    int invasions = 0;
+    int recorded = 0;
+    int attempts = 0;
+    tensorflow::FloatList raw_trait_freq; // trace of a recorded pilot invasion (discarded)
+    const invasion::Shortcuts<K> shortcuts(kernel, params);
+    rng::with_engine(options.rng_engine, seed, [&](auto &rng){
+      const clock::time_point start = clock::now();
+      while (invasions < fixed_parameters::cost_pilot_replicates &&
+	     std::chrono::duration<double>(clock::now() - start).count() < fixed_parameters::cost_pilot_seconds){
+	trait_freq::trait_counts<P> trait_count = trait_freq::initialise_trait_counts(params);
+	int gen = -1;
+	const bool record = number_recorded > 0 && invasions % 2 == 1;
+	const clock::time_point invasion_start = clock::now();
+	if (record){
+	  raw_trait_freq.Clear();
+	  invasion::trait_invasion(kernel, params, rng, trait_count, gen, &raw_trait_freq);
+	} else {
+	  invasion::trait_invasion(kernel, params, shortcuts, rng, trait_count, gen);
+	}
+	const clock::time_point invasion_end = clock::now();
+	const double seconds = std::chrono::duration<double>(invasion_end - invasion_start).count();
+	(record ? recorded_seconds : invasion_seconds) += seconds;
+	recorded += record;
+	invasions++;
+	if (params.shared.number_reinvasions > 0 && conditional_existence_status::allele_A_fixed(trait_count, params) &&
+	    !conditional_existence_status::trait_extinct(trait_count, params)){
+	  gen = -1;
+	  trait_count[ params.shared.trait_info[0] ] -= trait_freq::invader_count(params);
+	  invasion::trait_invasion(kernel, params, shortcuts, rng, trait_count, gen);
+	  attempt_seconds += std::chrono::duration<double>(clock::now() - invasion_end).count();
+	  attempts++;
+	}
+      }
+    });
+    const double attempt = attempts > 0 ? attempt_seconds / attempts : 0.0;
+    const double invasion = invasion_seconds / (invasions - recorded);
+    const double recorded_invasion = recorded > 0 ? recorded_seconds / recorded : invasion;
+    // the law is calculated only when it costs less than simulating the attempts (see reinvasion_law::calculate)
+    const bool geometric = options.reinvasions.compare("geometric") == 0 && params.shared.number_reinvasions > 0;
+    const double simulated_attempts = reinvasion_law::simulated_attempts(params, attempts, invasions);
+    bool exact = false;
+    if constexpr (markov_chain::has_exact_solver<K>::value){
+      exact = geometric && params.shared.population_size <= fixed_parameters::reinvasion_exact_population_size &&
+	environment_schedule::deterministic(kernel);
+    }
+    const bool pilot = geometric && !exact && reinvasion_law::pilot_pays(simulated_attempts);
+    const double replicate = invasion + static_cast<double>(attempts) / invasions *
+      (exact || pilot ? 1 : params.shared.number_reinvasions) * attempt;
+    double law = geometric ? fixed_parameters::reinvasion_gate_replicates * replicate : 0.0;
+    if (exact){
+      law += simulated_attempts * attempt; // the time of what it replaces, its work budget
+    } else if (pilot){
+      law += fixed_parameters::reinvasion_pilot_attempts * attempt;
+    }
+    const double recording = static_cast<double>(number_recorded) * std::max(recorded_invasion - invasion, 0.0);
+    return number_runs * (static_cast<double>(number_replicates) * replicate + recording + law);
+  }
+
+}
+
+#endif
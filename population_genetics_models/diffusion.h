@@ -0,0 +1,231 @@
+/**
+   @file diffusion.h
+   @brief Diffusion approximation (--engine=diffusion) for the single-environment haploid models
+*/
+#ifndef DIFFUSION_H
+#define DIFFUSION_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "include/example.pb.h"
+#include "Parameters.h"
+#include "markov_chain.h"
+#include "trait_freq.h"
+
+/**
+   @brief Namespace for the diffusion engine
+   @details For large N the allele A frequency of HSE/HTEOE is approximated by a diffusion with drift s p (1 - p)
+   and variance p (1 - p) / N, where s = log(wA / wa). Then
+   - the fixation probability from frequency p is Kimura's u(p) = (1 - exp(-2 N s p)) / (1 - exp(-2 N s))
+   - while A is rare, its count follows a Feller diffusion (drift s x, variance x), for which the probability
+   that x copies are lost by time t is G(t) = exp(2 s x / (exp(-s t) - 1)) (exp(-2 x / t) if s = 0). The
+   distribution of the generation of extinction is taken as G(gen + t0) scaled so that its total is 1 - u(p),
+   where the time origin t0 is chosen so that generation 0 matches the exact probability of loss in the first
+   generation, (1 - p')^N (the diffusion is poor over a single generation of a few copies)
+   - a reinvasion attempt (trait fixed, invader_count residents reintroduced) succeeds with probability u_a, the
+   fixation probability of the resident allele (selection coefficient -s); attempts are independent
+
+   The replicates are written in the per-replicate format: replicate i gets the (i + 0.5) / n quantile of these
+   distributions, so the lists are a deterministic (stratified) sample of number_replicates_QEF replicates.
+
+   The error of the approximation is estimated by comparing it with the exact Markov chain (see markov_chain) at
+   N = min(N, fixed_parameters::diffusion_validation_population_size) with the same fitnesses. The recorded error
+   is the error at that N and s only: the O(s) error of u(p) and of the loss times does not shrink as N grows at
+   fixed s, so it is no bound on the error at a larger N.
+*/
+namespace diffusion {
+  /** @brief True for the model kernels that the diffusion engine supports (haploid, one environment) */
+  template <class K>
+  struct has_diffusion_approximation :
+    std::bool_constant<K::Parameters::number_traits == 1 && K::number_environments == 1> {};
+  /**
+     @brief Kimura's fixation probability of an allele with selection coefficient \p s at frequency \p p
+  */
+  inline double fixation_probability(const int population_size, const double s, const double p){
+    if (s == 0.0){
+      return p;
+    }
+    return std::expm1(-2.0 * population_size * s * p) / std::expm1(-2.0 * population_size * s);
+  }
+  /**
+     @brief Probability that \p copies copies of a rare allele with selection coefficient \p s are lost by time \p t
+     (Feller diffusion)
+  */
+  inline double rare_allele_loss_by(const double copies, const double s, const double t){
+    if (s == 0.0){
+      return std::exp(-2.0 * copies / t);
+    }
+    return std::exp(2.0 * s * copies / std::expm1(-s * t));
+  }
+  /**
+     @brief Distributions given by the diffusion approximation for one parameter set
+  */
+  class Approximation {
+  public:
+    /**
+       @param[in] first_generation_loss Exact probability that the \p invader_count copies are lost in generation 0
+    */
+    Approximation(const int population_size, const double selection_coefficient, const int invader_count,
+		  const double first_generation_loss)
+      : s(selection_coefficient), copies(invader_count),
+	fixation(diffusion::fixation_probability(population_size, s,
+						 static_cast<double>(invader_count) / population_size)),
+	attempt_loss(diffusion::fixation_probability(population_size, -s,
+						     static_cast<double>(invader_count) / population_size)),
+	rare_loss_limit(s > 0.0 ? std::exp(-2.0 * s * invader_count) : 1.0),
+	time_origin(solve_time_origin(first_generation_loss)) {}
+    /** @brief P(trait lost by generation \p gen) */
+    double extinction_cdf(const int gen) const {
+      return (1.0 - fixation) * rare_allele_loss_by(copies, s, gen + time_origin) / rare_loss_limit;
+    }
+    double fixation_probability() const {
+      return fixation;
+    }
+    /** @brief P(the trait is lost in a reinvasion attempt) */
+    double attempt_loss_probability() const {
+      return attempt_loss;
+    }
+
+  private:
+    /** @brief Time t0 at which the scaled loss probability equals \p first_generation_loss (1 if there is none) */
+    double solve_time_origin(const double first_generation_loss) const {
+      const double log_loss = std::log(first_generation_loss * rare_loss_limit / (1.0 - fixation));
+      if (!(log_loss < std::log(rare_loss_limit)) || !std::isfinite(log_loss)){
+	return 1.0;
+      }
+      if (s == 0.0){
+	return -2.0 * copies / log_loss;
+      }
+      return -std::log1p(2.0 * s * copies / log_loss) / s;
+    }
+
+    double s;
+    double copies;
+    double fixation;
+    double attempt_loss;
+    double rare_loss_limit;
+    double time_origin;
+  };
+  /**
+     @brief Diffusion approximation for the parameters of \p kernel
+  */
+  template <class K>
+  Approximation approximate(const K &kernel, const int invader_count){
+    const double first_generation_loss = std::exp(kernel.population_size *
+						  std::log1p(-kernel.expectation(invader_count, 0)));
+    return Approximation(kernel.population_size, kernel.selection_coefficient(0), invader_count,
+			 first_generation_loss);
+  }
+  /**
+     @brief Writes number_replicates_QEF replicates (quantiles of the diffusion approximation)
+     @return Nothing (but fills \p gen_extinct and \p reinvasion_number, see record_data)
+  */
+  template <class K>
+  void calculate(const K &kernel, const typename K::Parameters &params, tensorflow::Int64List* gen_extinct,
+		 tensorflow::Int64List* reinvasion_number){
+    const int number_replicates = params.fixed.number_replicates_QEF;
+    const int max_gen = params.fixed.max_generations_per_sim;
+    const int number_reinvasions = params.shared.number_reinvasions;
+    const Approximation approximation = approximate(kernel, trait_freq::invader_count(params));
+    const double loss = 1.0 - approximation.fixation_probability();
+    const double attempt_survival = 1.0 - approximation.attempt_loss_probability();
+    gen_extinct->mutable_value()->Reserve(number_replicates);
+    reinvasion_number->mutable_value()->Reserve(number_replicates);
+    int gen = 0;
+    double cdf = approximation.extinction_cdf(gen);
+    for (int i = 0; i < number_replicates; i++){
+      const double quantile = (i + 0.5) / number_replicates;
+      if (quantile < loss){ // lost in the initial invasion (quantiles increase, so gen only moves forward)
+	while (cdf < quantile && gen < max_gen){
+	  cdf = approximation.extinction_cdf(++gen);
+	}
+	gen_extinct->add_value(gen);
+	reinvasion_number->add_value(-1);
+      } else { // fixed: number of reinvasion attempts survived is geometric (capped at number_reinvasions)
+	const double survived = 1.0 - (quantile - loss) / (1.0 - loss); // P(more attempts survived) in (0, 1]
+	int reinvasions = 0;
+	double survive_all = 1.0;
+	while (reinvasions < number_reinvasions && survive_all * attempt_survival >= survived){
+	  survive_all *= attempt_survival;
+	  reinvasions++;
+	}
+	gen_extinct->add_value(max_gen);
+	reinvasion_number->add_value(reinvasions);
+      }
+    }
+  }
+  /**
+     @brief Haploid single-environment kernel with a given N and allele fitnesses (for the exact solver)
+  */
+  template <class P>
+  struct Validation_Kernel {
+    using Parameters = P;
+    static constexpr int number_environments = 1;
+    const int population_size;
+    const double fitness_A;
+    const double fitness_a;
+
+    int environment(const int) const {
+      return 0;
+    }
+    double expectation(const int count, const int) const {
+      const double raw_A = count * fitness_A;
+      return raw_A / (raw_A + (population_size - count) * fitness_a);
+    }
+    double selection_coefficient(const int) const {
+      return std::log(fitness_A / fitness_a);
+    }
+  };
+  /**
+     @brief Records the error of the approximation against the exact Markov chain at a smaller N
+     @details Writes "diffusion_validation_population_size" (the N of the comparison), "diffusion_error_trait_persists"
+     (absolute error of P(trait fixed)) and "diffusion_error_extinction_cdf" (largest absolute error of
+     P(trait lost by gen) over all generations).
+  */
+  template <class K>
+  void record_error_estimate(const K &kernel, const typename K::Parameters &params,
+			     google::protobuf::Map<std::string, tensorflow::Feature>* feature_map){
+    using P = typename K::Parameters;
+    const int population_size = std::min(kernel.population_size, fixed_parameters::diffusion_validation_population_size);
+    const int invader_count = std::min(trait_freq::invader_count(params), population_size);
+    const P validation_params {{population_size, static_cast<double>(invader_count) / population_size,
+	params.shared.number_reinvasions, params.shared.trait_info}, params.model, params.fixed};
+    const Validation_Kernel<P> validation_kernel {population_size, kernel.fitness_A, kernel.fitness_a};
+    std::vector<markov_chain::Transition_Matrix> matrices;
+    std::vector<bool> built;
+    std::vector<double> start(population_size + 1, 0.0);
+    start[invader_count] = 1.0;
+    const markov_chain::Attempt exact = markov_chain::run_attempt(validation_kernel, validation_params, start,
+								 matrices, built);
+    const Approximation approximation = approximate(validation_kernel, invader_count);
+
+    double persists = 0.0;
+    for (const double probability : exact.persisting){
+      persists += probability;
+    }
+    double exact_cdf = 0.0;
+    double cdf_error = 0.0;
+    for (int gen = 0; gen < static_cast<int>(exact.extinct_by_gen.size()); gen++){
+      exact_cdf += exact.extinct_by_gen[gen];
+      cdf_error = std::max(cdf_error, std::fabs(exact_cdf - approximation.extinction_cdf(gen)));
+    }
+    // beyond the last generation solved exactly, the exact CDF is constant
+    cdf_error = std::max(cdf_error, std::fabs(exact_cdf - (1.0 - approximation.fixation_probability())));
+
+    tensorflow::Feature validation_size = tensorflow::Feature();
+    validation_size.mutable_int64_list()->add_value(population_size);
+    tensorflow::Feature persists_error = tensorflow::Feature();
+    persists_error.mutable_float_list()->add_value(std::fabs(persists - approximation.fixation_probability()));
+    tensorflow::Feature extinction_cdf_error = tensorflow::Feature();
+    extinction_cdf_error.mutable_float_list()->add_value(cdf_error);
+    (*feature_map)["diffusion_validation_population_size"] = validation_size;
+    (*feature_map)["diffusion_error_trait_persists"] = persists_error;
+    (*feature_map)["diffusion_error_extinction_cdf"] = extinction_cdf_error;
+  }
+
+}
+
+#endif
@@ -0,0 +1,192 @@
+/**
+   @file ensemble_invasion.h
+   @brief Runs haploid replicates as an ensemble (a histogram of replicates over allele counts)
+*/
+#ifndef ENSEMBLE_INVASION_H
+#define ENSEMBLE_INVASION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "Parameters.h"
+#include "binomial.h"
+#include "markov_chain.h"
+#include "trait_freq.h"
+
+/**
+   @brief Namespace for the ensemble replicate engine (--engine=ensemble)
+   @details Replicates are exchangeable and (within an invasion attempt) all in the same generation, so the
+   state of many replicates is just the number of replicates with each allele A count. Each generation, the
+   replicates with count i move to count j with probability Binomial(N, p_i) at j, where p_i = K::expectation(i,
+   gen); all replicates in state i are moved at once by a multinomial draw over the band of j (conditional
+   binomials, see markov_chain::Binomial_Pmf), or one by one when there are fewer replicates than the band is wide.
+   Work therefore scales with the number of occupied counts rather than the number of replicates.
+
+   Extinctions are counted per generation and the replicates are written out in the per-replicate format: the
+   outcomes (grouped by generation of extinction and number of reinvasions survived) are shuffled with the stream
+   of the ensemble, so the replicates of a chunk are in random order like those of the per-replicate engines (and
+   any prefix of them is a sample from the same distribution).
+*/
+namespace ensemble_invasion {
+  /**
+     @brief Number of replicates with each allele A count (only occupied counts are listed)
+  */
+  struct Histogram {
+    std::vector<int> replicates; /**< Number of replicates with count c, for c in [0, N] */
+    std::vector<int> occupied; /**< Counts with at least one replicate (in no particular order) */
+    std::vector<int> position; /**< Index of count c in occupied (-1 if it is not occupied) */
+
+    explicit Histogram(const int population_size)
+      : replicates(population_size + 1, 0), position(population_size + 1, -1) {}
+    void add(const int count, const int number){
+      if (number == 0){
+	return;
+      }
+      if (replicates[count] == 0){
+	position[count] = static_cast<int>(occupied.size());
+	occupied.push_back(count);
+      }
+      replicates[count] += number;
+    }
+    void clear(){
+      for (const int count : occupied){
+	replicates[count] = 0;
+	position[count] = -1;
+      }
+      occupied.clear();
+    }
+    /** @brief Removes and returns the replicates with \p count */
+    int take(const int count){
+      const int number = replicates[count];
+      if (number > 0){
+	// move the last occupied count into the slot of count
+	const int slot = position[count];
+	occupied[slot] = occupied.back();
+	position[occupied[slot]] = slot;
+	occupied.pop_back();
+	replicates[count] = 0;
+	position[count] = -1;
+      }
+      return number;
+    }
+  };
+  /**
+     @brief Moves the \p number replicates with allele A count \p count forward one generation into \p next
+     @param[in, out] tail Buffer for the tail probabilities of the band (reused between calls)
+  */
+  template <class R>
+  void step_state(const int population_size, const double p, const int number, R &rng,
+		  const std::vector<double> &log_factorial, const double log_tolerance, std::vector<double> &tail,
+		  Histogram &next){
+    // approximate width of the band: cheaper to sample replicates one at a time below this
+    const double width = 1.0 + 16.0 * std::sqrt(population_size * p * (1.0 - p));
+    if (number < width){
+      for (int replicate = 0; replicate < number; replicate++){
+	next.add(binomial::sample(rng, population_size, p), 1);
+      }
+      return;
+    }
+    const markov_chain::Binomial_Pmf pmf(population_size, p, log_factorial);
+    const auto [lo, hi] = pmf.band(log_tolerance);
+    tail.resize(hi - lo + 2); // tail[j - lo] = P(j <= X <= hi)
+    tail[hi - lo + 1] = 0.0;
+    for (int j = hi; j >= lo; j--){
+      tail[j - lo] = tail[j - lo + 1] + std::exp(pmf.log_pmf(j));
+    }
+    int remaining = number;
+    for (int j = lo; j < hi && remaining > 0; j++){
+      const int moved = binomial::sample(rng, remaining, (tail[j - lo] - tail[j - lo + 1]) / tail[j - lo]);
+      next.add(j, moved);
+      remaining -= moved;
+    }
+    next.add(hi, remaining);
+  }
+  /**
+     @brief Runs one invasion attempt for all replicates in \p population
+     @param[in, out] population Replicates at the start of the attempt; on return, the replicates in which the
+     trait persists (fixed, or present at the max gen)
+     @param[out] extinct_by_gen If not null, number of replicates lost in each generation
+     @return Number of replicates in which the trait was lost
+  */
+  template <class K, class R>
+  int run_attempt(const K &kernel, const typename K::Parameters &params, R &rng,
+		  const std::vector<double> &log_factorial, Histogram &population, std::vector<int>* extinct_by_gen){
+    const int N = params.shared.population_size;
+    const double log_tolerance = std::log(params.fixed.exact_band_tolerance);
+    Histogram next(N);
+    std::vector<double> tail;
+    int extinct = 0;
+    int fixed = 0;
+    int gen = -1;
+    while (!population.occupied.empty() && gen < params.fixed.max_generations_per_sim){
+      next.clear();
+      for (const int count : population.occupied){
+	step_state(N, kernel.expectation(count, gen), population.replicates[count], rng, log_factorial,
+		   log_tolerance, tail, next);
+      }
+      ++gen;
+      const int lost = next.take(0);
+      fixed += next.take(N);
+      extinct += lost;
+      if (extinct_by_gen != nullptr && lost > 0){
+	if (static_cast<int>(extinct_by_gen->size()) <= gen){
+	  extinct_by_gen->resize(gen + 1, 0);
+	}
+	(*extinct_by_gen)[gen] += lost;
+      }
+      std::swap(population, next);
+    }
+    population.add(N, fixed);
+    return extinct;
+  }
+  /**
+     @brief Runs \p number_replicates replicates (invasion plus reinvasion attempts) as an ensemble
+     @param[out] gen_extinct Generation of extinction of each replicate (max_generations_per_sim if the trait persists)
+     @param[out] reinvasion_number Number of reinvasions before extinction of each replicate (see record_data)
+     @return Nothing (but fills \p gen_extinct and \p reinvasion_number)
+  */
+  template <class K, class R>
+  void run_replicates(const K &kernel, const typename K::Parameters &params, R &rng, const int number_replicates,
+		      std::int64_t* gen_extinct, std::int64_t* reinvasion_number){
+    const int N = params.shared.population_size;
+    const int invader_count = trait_freq::invader_count(params);
+    const int max_gen = params.fixed.max_generations_per_sim;
+    const std::vector<double> log_factorial = markov_chain::log_factorials(N);
+    Histogram population(N);
+    population.add(invader_count, number_replicates);
+    std::vector<int> extinct_by_gen;
+    run_attempt(kernel, params, rng, log_factorial, population, &extinct_by_gen);
+
+    int replicate = 0;
+    auto write = [&](const int number, const int gen, const int reinvasions){
+      for (int i = 0; i < number; i++, replicate++){
+	gen_extinct[replicate] = gen;
+	reinvasion_number[replicate] = reinvasions;
+      }
+    };
+    for (int gen = 0; gen < static_cast<int>(extinct_by_gen.size()); gen++){
+      write(extinct_by_gen[gen], gen, -1);
+    }
+    for (int reinvasion = 0; reinvasion < params.shared.number_reinvasions; reinvasion++){
+      // replace invader_count individuals carrying trait of interest with individuals carrying resident trait
+      Histogram reinvaded(N);
+      for (const int count : population.occupied){
+	reinvaded.add(std::max(count - invader_count, 0), population.replicates[count]);
+      }
+      population = std::move(reinvaded);
+      write(run_attempt(kernel, params, rng, log_factorial, population, nullptr), max_gen, reinvasion);
+    }
+    write(number_replicates - replicate, max_gen, params.shared.number_reinvasions);
+    // into replicate order (Fisher-Yates)
+    for (int i = number_replicates - 1; i > 0; i--){
+      const int j = std::min(static_cast<int>(binomial::uniform_01(rng) * (i + 1)), i);
+      std::swap(gen_extinct[i], gen_extinct[j]);
+      std::swap(reinvasion_number[i], reinvasion_number[j]);
+    }
+  }
+
+}
+
+#endif
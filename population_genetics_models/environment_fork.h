@@ -0,0 +1,137 @@
+/**
+   @file environment_fork.h
+   @brief Runs an HTE sweep over the generation of the switch to environment 2 from shared prefixes (--switch_generations)
+*/
+#ifndef ENVIRONMENT_FORK_H
+#define ENVIRONMENT_FORK_H
+
+#include <algorithm>
+#include <vector>
+#include "include/example.pb.h"
+#include "Parameters.h"
+#include "conditional_existence_probability.h"
+#include "conditional_existence_status.h"
+#include "reinvasion_law.h"
+#include "rng.h"
+#include "thread_pool.h"
+#include "trait_freq.h"
+#include "trait_invasion.h"
+
+/**
+   @brief Namespace for the forked switch-generation sweep
+   @details Runs with different switch generations g_1 < ... < g_m (HTE gen_env_1) are the same Markov chain until
+   the first switch, so the initial invasion of a replicate is simulated once in environment 1 (the prefix) and
+   forked at each g_j it reaches while the trait is still segregating: the fork copies the state and continues it
+   in environment 2 with the kernel for g_j and its own stream. If the prefix ends (loss, fixation or
+   max_generations_per_sim) before g_j, the run for g_j has the same outcome. Each branch therefore has exactly the
+   distribution of a separate run with gen_env_1 = g_j (the branches of one replicate are dependent, which does
+   not matter as they are recorded separately). Reinvasion attempts start again in environment 1, so they are run
+   per branch.
+
+   Stream layout of the root engine: the prefix of chunk c uses stream c (as calculate() does), the streams
+   reserved for the reinvasion law (reinvasion_law::reserved_streams) are skipped, and branch j of chunk c uses
+   the stream after them at c * m + j.
+*/
+namespace environment_fork {
+  /**
+     @brief Runs one replicate for every switch generation
+     @param[in] kernels Kernel of each switch generation (in increasing order of \p switch_generations)
+     @param[in] shortcuts Shortcuts of each switch generation
+     @param[in, out] prefix_rng Stream of the prefix
+     @param[in, out] branch_rng Stream of each branch (one per switch generation)
+     @return Nothing (but appends one value to each list of every switch generation)
+  */
+  template <class K, class R>
+  void run_replicate(const std::vector<K> &kernels, const std::vector<typename K::Parameters> &params,
+		     const std::vector<invasion::Shortcuts<K>> &shortcuts,
+		     const std::vector<int> &switch_generations, R &prefix_rng, R* branch_rng,
+		     const std::vector<reinvasion_law::Law<typename K::Parameters>> &laws,
+		     tensorflow::Int64List* gen_extinct, tensorflow::Int64List* reinvasion_number){
+    using P = typename K::Parameters;
+    const int branches = static_cast<int>(kernels.size());
+    // the last switch comes after every step of the prefix, so its kernel is in environment 1 throughout
+    const K &prefix_kernel = kernels.back();
+    const P &prefix_params = params.back();
+    trait_freq::trait_counts<P> trait_count = trait_freq::initialise_trait_counts(prefix_params);
+    int gen = -1;
+    bool ended = false;
+    int branch = 0;
+    while (true){
+      // fork every branch whose switch has been reached (or, once the prefix has ended, that it never reaches)
+      for (; branch < branches && (ended || gen >= switch_generations[branch]); branch++){
+	trait_freq::trait_counts<P> branch_count = trait_count;
+	int branch_gen = gen;
+	if (!ended){
+	  invasion::trait_invasion(kernels[branch], params[branch], shortcuts[branch], branch_rng[branch], branch_count,
+				   branch_gen);
+	}
+	conditional_existence_probability::record_and_reinvade(kernels[branch], params[branch], shortcuts[branch],
+							       branch_rng[branch], branch_count, branch_gen, laws[branch],
+							       &gen_extinct[branch], &reinvasion_number[branch]);
+      }
+      if (branch == branches){
+	return;
+      }
+      prefix_kernel.step(trait_count, prefix_rng, gen);
+      ++gen;
+      ended = conditional_existence_status::allele_A_extinct(trait_count, prefix_params) ||
+	conditional_existence_status::allele_A_fixed(trait_count, prefix_params) ||
+	conditional_existence_status::reached_max_gen(gen, prefix_params);
+    }
+  }
+  /**
+     @brief Runs the QEF replicates for every switch generation
+     @details Uses the same chunks as conditional_existence_probability::calculate(); replicate i of each switch
+     generation is recorded in replicate order in the lists of that switch generation.
+     @param[in] kernels Kernel of each switch generation (in increasing order of \p switch_generations)
+     @param[in] params Parameters of each switch generation
+     @param[in] switch_generations Generations of the switch to environment 2 (increasing)
+     @param[in] laws Law of the reinvasion attempts of each switch generation
+     @param[out] gen_extinct Generation of extinction of each switch generation
+     @param[out] reinvasion_number Number of reinvasions of each switch generation
+  */
+  template <class K, class R>
+  void calculate(const std::vector<K> &kernels, const std::vector<typename K::Parameters> &params,
+		 const std::vector<int> &switch_generations, R &rng,
+		 const std::vector<reinvasion_law::Law<typename K::Parameters>> &laws,
+		 const std::vector<tensorflow::Int64List*> &gen_extinct,
+		 const std::vector<tensorflow::Int64List*> &reinvasion_number){
+
+    const int branches = static_cast<int>(kernels.size());
+    const int number_replicates = params[0].fixed.number_replicates_QEF;
+    const int chunks = conditional_existence_probability::number_chunks(params[0], number_replicates);
+    const int first_branch_stream = reinvasion_law::reserved_streams(params[0]);
+    std::vector<R> streams = rng::make_streams(rng, first_branch_stream + chunks * branches);
+    // per chunk: generation of extinction and number of reinvasions of each switch generation
+    std::vector<std::vector<tensorflow::Int64List>> chunk_gen_extinct(chunks,
+								      std::vector<tensorflow::Int64List>(branches));
+    std::vector<std::vector<tensorflow::Int64List>> chunk_reinvasion_number(chunks,
+									    std::vector<tensorflow::Int64List>(branches));
+    std::vector<invasion::Shortcuts<K>> shortcuts;
+    for (int branch = 0; branch < branches; branch++){
+      shortcuts.emplace_back(kernels[branch], params[branch]);
+    }
+
+    thread_pool::get_pool().parallel_for(chunks, [&](int chunk){
+      const int first = chunk * params[0].fixed.replicates_per_chunk;
+      const int last = std::min(first + params[0].fixed.replicates_per_chunk, number_replicates);
+      for (int i = first; i < last; i++){
+	run_replicate(kernels, params, shortcuts, switch_generations, streams[chunk],
+		      streams.data() + first_branch_stream + chunk * branches, laws,
+		      chunk_gen_extinct[chunk].data(), chunk_reinvasion_number[chunk].data());
+      }
+    });
+    // merge in replicate order
+    for (int branch = 0; branch < branches; branch++){
+      gen_extinct[branch]->mutable_value()->Reserve(number_replicates);
+      reinvasion_number[branch]->mutable_value()->Reserve(number_replicates);
+      for (int chunk = 0; chunk < chunks; chunk++){
+	gen_extinct[branch]->MergeFrom(chunk_gen_extinct[chunk][branch]);
+	reinvasion_number[branch]->MergeFrom(chunk_reinvasion_number[chunk][branch]);
+      }
+    }
+  }
+
+}
+
+#endif
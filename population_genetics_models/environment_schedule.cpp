@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "environment_schedule.h"
+#include "include/example.pb.h"
+
+namespace environment_schedule {
+
+  namespace {
+    /** @brief Splits \p value at commas (no entries if it is empty) */
+    std::vector<std::string> split(const std::string &value){
+      std::vector<std::string> entries;
+      for (std::size_t begin = 0; begin < value.size();){
+	const std::size_t comma = std::min(value.find(',', begin), value.size());
+	entries.push_back(value.substr(begin, comma - begin));
+	begin = comma + 1;
+      }
+      return entries;
+    }
+  }
+
+  Schedule::Schedule(const std::string &spec, const int gen_env_1, const int number_environments)
+    : environments(number_environments) {
+    const std::size_t colon = spec.find(':');
+    kind = spec.substr(0, colon);
+    periodic = kind.compare("periodic") == 0;
+    markov = kind.compare("markov") == 0;
+    const std::vector<std::string> entries = split(colon == std::string::npos ? "" : spec.substr(colon + 1));
+    if (kind.compare("switch") == 0){
+      assert(entries.empty() && "--environment_schedule=switch takes no table");
+      // the steps from generations -1, ..., gen_env_1 - 1 are in environment 1
+      run_environment = {0, 1};
+      run_end = {std::max(gen_env_1 + 1LL, 0LL), LLONG_MAX};
+    } else if (kind.compare("piecewise") == 0 || periodic){
+      assert(!entries.empty() && "--environment_schedule=piecewise and periodic need a run-length table");
+      long long end = 0;
+      for (std::size_t i = 0; i < entries.size(); i++){
+	const std::size_t separator = entries[i].find(':');
+	const int env = std::stoi(entries[i].substr(0, separator)) - 1;
+	assert(env >= 0 && env < environments && "--environment_schedule: unknown environment");
+	const bool last = i + 1 == entries.size();
+	assert((separator != std::string::npos || (last && !periodic)) &&
+	       "--environment_schedule: runs must be environment:length (the last piecewise length may be omitted)");
+	const long long length = separator == std::string::npos ? 0 : std::stoll(entries[i].substr(separator + 1));
+	assert(length >= 0 && "--environment_schedule: run lengths must be non-negative");
+	end += length;
+	run_environment.push_back(env);
+	run_end.push_back(last && !periodic ? LLONG_MAX : end); // the last environment persists
+      }
+      if (periodic){
+	period = end;
+	assert(period > 0 && "--environment_schedule=periodic needs a positive period");
+      }
+    } else if (markov){
+      assert(static_cast<int>(entries.size()) == environments * environments &&
+	     "--environment_schedule=markov needs one transition probability per pair of environments");
+      transition.assign(environments, std::vector<double>(environments));
+      for (int from = 0; from < environments; from++){
+	double total = 0.0;
+	for (int to = 0; to < environments; to++){
+	  transition[from][to] = std::stod(entries[from * environments + to]);
+	  assert(transition[from][to] >= 0.0 && "--environment_schedule: transition probabilities must be non-negative");
+	  total += transition[from][to];
+	}
+	assert(std::fabs(total - 1.0) < 1e-9 && "--environment_schedule: transition rows must sum to 1");
+      }
+      run_environment = {0};
+      run_end = {LLONG_MAX};
+      constant_environment = environments == 1 ? 0 : -1;
+      return;
+    } else {
+      assert(false && "--environment_schedule must be switch, piecewise, periodic or markov");
+    }
+    last_run_start = run_end.size() > 1 ? run_end[run_end.size() - 2] : 0;
+    // a schedule whose runs (of positive length) are all in one environment never changes it
+    constant_environment = run_environment.back();
+    for (std::size_t i = 0; i < run_environment.size(); i++){
+      const long long start = i == 0 ? 0 : run_end[i - 1];
+      if (run_end[i] > start && run_environment[i] != constant_environment){
+	constant_environment = -1;
+      }
+    }
+  }
+
+  void Schedule::record(google::protobuf::Map<std::string, tensorflow::Feature>* map) const {
+    tensorflow::Feature schedule = tensorflow::Feature();
+    tensorflow::BytesList* schedule_kind = schedule.mutable_bytes_list();
+    schedule_kind->add_value(kind);
+    (*map)["environment_schedule"] = schedule;
+
+    if (!deterministic()){
+      tensorflow::Feature transitions = tensorflow::Feature();
+      tensorflow::FloatList* transition_matrix = transitions.mutable_float_list();
+      for (const std::vector<double> &row : transition){
+	for (const double probability : row){
+	  transition_matrix->add_value(probability);
+	}
+      }
+      (*map)["environment_schedule_transitions"] = transitions;
+      return;
+    }
+    // environments numbered from 1; the length of a run that lasts for the rest of the attempt is -1
+    tensorflow::Feature environments_recorded = tensorflow::Feature();
+    tensorflow::Int64List* run_environments = environments_recorded.mutable_int64_list();
+    tensorflow::Feature lengths = tensorflow::Feature();
+    tensorflow::Int64List* run_lengths = lengths.mutable_int64_list();
+    for (std::size_t i = 0; i < run_environment.size(); i++){
+      run_environments->add_value(run_environment[i] + 1);
+      run_lengths->add_value(run_end[i] == LLONG_MAX ? -1 : run_end[i] - (i == 0 ? 0 : run_end[i - 1]));
+    }
+    (*map)["environment_schedule_environments"] = environments_recorded;
+    (*map)["environment_schedule_lengths"] = lengths;
+  }
+
+}
@@ -0,0 +1,186 @@
+/**
+   @file environment_schedule.h
+   @brief Environment schedules of the HTE model (--environment_schedule)
+*/
+#ifndef ENVIRONMENT_SCHEDULE_H
+#define ENVIRONMENT_SCHEDULE_H
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "include/example.pb.h"
+#include "binomial.h"
+
+/**
+   @brief Namespace for environment schedules
+   @details A schedule gives the environment of every generation of an invasion attempt. Positions count the
+   generations of an attempt from 0 (the step from the initial state, gen = -1 in invasion::trait_invasion), and
+   environments are numbered from 1 on the command line (from 0 internally).
+   - switch (default): environment 1 until generation gen_env_1, then environment 2 (the HTE model arguments)
+   - piecewise:e1:l1,e2:l2,...: a run-length table (environment e1 for l1 generations, then e2 for l2, ...); the
+   last environment lasts for the rest of the attempt (its length may be omitted)
+   - periodic:e1:l1,e2:l2,...: the run-length table repeated
+   - markov:p11,p12,...: a Markov chain on the environments (row-major transition matrix), starting in environment 1;
+   the environment of a generation is then random, so these schedules need --engine=scalar and --sampler=binomial
+
+   The per-replicate engine runs an attempt segment by segment (Cursor): each segment is a run of generations in one
+   environment, stepped by the kernel of that environment without looking the environment up per generation.
+   The other engines call K::environment(gen), which the deterministic schedules answer from the table (and which
+   a Markov schedule cannot answer: see deterministic()).
+*/
+namespace environment_schedule {
+  /**
+     @brief Run of generations in one environment: the steps with gen < end are in \p environment
+  */
+  struct Segment {
+    int environment;
+    int end;
+  };
+  /**
+     @brief Environment schedule parsed from --environment_schedule
+  */
+  class Schedule {
+  public:
+    /**
+       @param[in] spec Value of --environment_schedule (see the namespace description)
+       @param[in] gen_env_1 Generation of the switch of the switch schedule
+       @param[in] number_environments Number of environments of the model
+    */
+    Schedule(const std::string &spec, const int gen_env_1, const int number_environments);
+    /** @brief True unless the environments follow a Markov chain */
+    bool deterministic() const {
+      return !markov;
+    }
+    /** @brief Environment of the step from generation \p gen (deterministic schedules) */
+    int environment(const int gen) const {
+      assert(deterministic() && "The environment of a generation of a markov schedule is random (use a Cursor)");
+      return run_environment[run(position(gen))];
+    }
+    /** @brief Environment of every generation from \p gen on (-1 if it still changes or is random) */
+    int final_environment(const int gen) const {
+      if (constant_environment >= 0 || periodic || markov){
+	return constant_environment;
+      }
+      return position(gen) >= last_run_start ? run_environment.back() : -1;
+    }
+    /** @brief Segment that contains the step from generation \p gen (deterministic schedules) */
+    Segment segment(const int gen) const {
+      long long t = position(gen);
+      long long cycle_start = 0;
+      if (periodic){
+	cycle_start = t - t % period;
+	t -= cycle_start;
+      }
+      const int i = run(t);
+      if (!periodic && i == static_cast<int>(run_end.size()) - 1){
+	return {run_environment[i], INT_MAX};
+      }
+      return {run_environment[i], static_cast<int>(std::min<long long>(cycle_start + run_end[i] - 1, INT_MAX))};
+    }
+    int number_environments() const {
+      return environments;
+    }
+    /** @brief P(next environment is \p to | environment \p from) (Markov schedules) */
+    double transition_probability(const int from, const int to) const {
+      return transition[from][to];
+    }
+    /**
+       @brief Records the schedule ("environment_schedule" and its table or transition matrix)
+    */
+    void record(google::protobuf::Map<std::string, tensorflow::Feature>* map) const;
+
+  private:
+    /** @brief Position of the step from generation \p gen in the attempt */
+    static long long position(const int gen){
+      return static_cast<long long>(gen) + 1;
+    }
+    /** @brief Run that contains position \p t (within a cycle for periodic schedules) */
+    int run(long long t) const {
+      if (periodic){
+	t %= period;
+      }
+      const int i = static_cast<int>(std::upper_bound(run_end.begin(), run_end.end(), t) - run_end.begin());
+      return std::min(i, static_cast<int>(run_end.size()) - 1);
+    }
+
+    std::string kind; /**< switch, piecewise, periodic, or markov */
+    bool periodic;
+    bool markov;
+    int environments;
+    std::vector<int> run_environment; /**< Environment of each run (deterministic schedules) */
+    std::vector<long long> run_end; /**< Position at which each run ends (cumulative lengths) */
+    long long period = 0; /**< Sum of the run lengths (periodic) */
+    long long last_run_start = 0;
+    int constant_environment = -1; /**< The environment if all runs are in it, otherwise -1 */
+    std::vector<std::vector<double>> transition; /**< Transition matrix (markov) */
+  };
+  /**
+     @brief Walks the segments of one invasion attempt (draws the environments of a Markov schedule)
+  */
+  class Cursor {
+  public:
+    explicit Cursor(const Schedule &schedule) : schedule(schedule) {}
+    /** @brief Segment that starts with the step from generation \p gen (the previous segment ended there) */
+    template <class R>
+    Segment next(const int gen, R &rng){
+      if (schedule.deterministic()){
+	return schedule.segment(gen);
+      }
+      if (environment < 0){
+	environment = 0;
+      } else {
+	// leave the current environment (the stay was drawn as the segment length)
+	const double leave = 1.0 - schedule.transition_probability(environment, environment);
+	double u = binomial::uniform_01(rng) * leave;
+	int to = -1;
+	for (int env = 0; env < schedule.number_environments(); env++){
+	  if (env != environment){
+	    to = env;
+	    u -= schedule.transition_probability(environment, env);
+	    if (u < 0.0){
+	      break;
+	    }
+	  }
+	}
+	environment = to;
+      }
+      // number of steps in the environment: geometric with P(stay) = p_ee
+      const double stay = schedule.transition_probability(environment, environment);
+      double length = 1.0;
+      if (stay >= 1.0){
+	length = INT_MAX;
+      } else if (stay > 0.0){
+	length += std::floor(std::log1p(-binomial::uniform_01(rng)) / std::log(stay));
+      }
+      return {environment, static_cast<int>(std::min<double>(gen + length, INT_MAX))};
+    }
+
+  private:
+    const Schedule &schedule;
+    int environment = -1;
+  };
+  /** @brief True for the model kernels whose environments follow a schedule (HTE) */
+  template <class K, class = void>
+  struct has_schedule : std::false_type {};
+  template <class K>
+  struct has_schedule<K, std::void_t<decltype(std::declval<const K&>().schedule)>> : std::true_type {};
+  /**
+     @brief True if the environment of every generation of \p kernel is known in advance, so that K::environment can
+     be called (false for a Markov schedule, whose attempts can only be simulated with a Cursor)
+  */
+  template <class K>
+  bool deterministic(const K &kernel){
+    if constexpr (has_schedule<K>::value){
+      return kernel.schedule.deterministic();
+    }
+    return true;
+  }
+
+}
+
+#endif
@@ -1,12 +1,43 @@
 #ifndef FIXED_PARAMETERS_H
 #define FIXED_PARAMETERS_H
 
+#include <cstddef>
+
 namespace fixed_parameters {
 
-  inline constexpr double tolerance = 0.000000000001;
   inline constexpr int number_replicates_QEF = 1000000;
   inline constexpr int number_replicates_LSTM = 1000;
   inline constexpr int max_generations_per_sim = 1000000;
+  inline constexpr int replicates_per_chunk = 1000;
+  inline constexpr int batch_lanes = 256;
+  inline constexpr int replicates_per_ensemble = 62500;
+  inline constexpr std::size_t alias_table_budget_bytes = std::size_t(1) << 28;
+  inline constexpr double exact_band_tolerance = 1e-18;
+  inline constexpr double exact_convergence_tolerance = 1e-12;
+  inline constexpr int exact_columns_per_task = 256;
+  inline constexpr int exact_max_population_size = 10000;
+  inline constexpr int diffusion_validation_population_size = 500;
+  inline constexpr int backward_equation_grid_refinement = 4;
+  inline constexpr double backward_equation_max_step_probability = 0.5;
+  inline constexpr int backward_equation_layer_copies = 16;
+  inline constexpr int backward_equation_nodes_per_task = 1024;
+  inline constexpr int branching_handoff_count = 64;
+  inline constexpr double branching_residual_probability = 1e-4;
+  inline constexpr int quasi_stationary_window = 1000;
+  inline constexpr int quasi_stationary_grid_intervals = 4096;
+  inline constexpr int quasi_stationary_min_escape_windows = 10;
+  inline constexpr int reinvasion_exact_population_size = 2000;
+  inline constexpr int reinvasion_exact_work_per_generation = 64;
+  inline constexpr int reinvasion_pilot_attempts = 100000;
+  inline constexpr int reinvasion_pilot_min_outcomes = 100;
+  inline constexpr int reinvasion_gate_replicates = 1000;
+  inline constexpr int cost_pilot_replicates = 1000;
+  inline constexpr double cost_pilot_seconds = 0.05;
+  inline constexpr int adaptive_block_replicates = 50000;
+  inline constexpr double adaptive_confidence_z = 1.959963984540054;
+  inline constexpr int splitting_trajectories_per_stage = 10000;
+  inline constexpr int splitting_pilot_trajectories = 1000;
+  inline constexpr double splitting_stage_probability = 0.1;
   
 }
 
@@ -0,0 +1,128 @@
+/**
+   @file genotype_coupling.h
+   @brief Couples the DSE replicates of the two traits of interest (AA and Aa) so that they share a trajectory
+*/
+#ifndef GENOTYPE_COUPLING_H
+#define GENOTYPE_COUPLING_H
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <type_traits>
+#include <vector>
+#include "Parameters.h"
+#include "alias_table.h"
+#include "binomial.h"
+#include "markov_chain.h"
+#include "trait_freq.h"
+
+/**
+   @brief Namespace for recording both DSE traits from one pass (--traits=both)
+   @details A replicate for trait AA starts from one AA individual and a replicate for trait Aa from one Aa
+   individual, so the two runs differ in their initial state (and in what they record and how they reinvade), but
+   from generation 0 on they are the same Markov chain (the next generation depends only on the genotype counts).
+   The states after generation 0 of the two runs are drawn from a maximal coupling of their distributions: with
+   probability equal to the overlap of the two distributions both runs are in the same state, and the trajectory
+   from there is simulated once and recorded for both traits; otherwise the runs are in different states and are
+   simulated separately. Each trait's replicates have exactly the distribution of separate runs (the replicates of
+   the two traits with the same index are dependent, which does not matter as they are recorded separately).
+*/
+namespace genotype_coupling {
+  /** @brief True for the model kernels with two traits of interest (DSE) */
+  template <class K>
+  struct has_coupling : std::bool_constant<K::Parameters::number_traits == 2> {};
+  /**
+     @brief States after generation 0 of the runs for the two traits
+  */
+  template <class P>
+  struct Outcome {
+    trait_freq::trait_counts<P> homozygote; /**< State of the run started from one AA individual */
+    trait_freq::trait_counts<P> heterozygote; /**< State of the run started from one Aa individual */
+    bool shared; /**< True if the states are equal (one trajectory serves both runs) */
+  };
+  /**
+     @brief Maximal coupling of the generation-0 distributions from one AA and from one Aa individual
+  */
+  template <class K>
+  class First_Generation {
+  public:
+    using P = typename K::Parameters;
+    using State = trait_freq::trait_counts<P>;
+
+    First_Generation(const K &kernel, const P &params){
+      const int invader_count = trait_freq::invader_count(params);
+      const std::map<State, double> from_AA = distribution(kernel, params, State {invader_count, 0});
+      const std::map<State, double> from_Aa = distribution(kernel, params, State {0, invader_count});
+      std::vector<double> common_probability, only_AA_probability, only_Aa_probability;
+      for (const auto &[state, probability] : from_AA){
+	const auto match = from_Aa.find(state);
+	const double both = match == from_Aa.end() ? 0.0 : std::min(probability, match->second);
+	add(common, common_probability, state, both);
+	add(only_AA, only_AA_probability, state, probability - both);
+      }
+      for (const auto &[state, probability] : from_Aa){
+	const auto match = from_AA.find(state);
+	add(only_Aa, only_Aa_probability, state, probability - (match == from_AA.end() ? 0.0 :
+								  std::min(probability, match->second)));
+      }
+      double residual = 0.0;
+      for (const double probability : common_probability){
+	overlap += probability;
+      }
+      for (const double probability : only_AA_probability){
+	residual += probability;
+      }
+      overlap /= overlap + residual; // normalised for the mass lost to the band
+      common_table = alias_table::Alias_Table(common_probability);
+      only_AA_table = alias_table::Alias_Table(only_AA_probability);
+      only_Aa_table = alias_table::Alias_Table(only_Aa_probability);
+    }
+    /** @brief Probability that the two runs share their trajectory */
+    double overlap_probability() const {
+      return overlap;
+    }
+    template <class R>
+    Outcome<P> sample(R &rng) const {
+      if (only_AA.empty() || binomial::uniform_01(rng) < overlap){
+	const State &state = common[common_table.sample(rng)];
+	return {state, state, true};
+      }
+      return {only_AA[only_AA_table.sample(rng)], only_Aa[only_Aa_table.sample(rng)], false};
+    }
+
+  private:
+    /** @brief Distribution of the state after one generation from \p start (states of probability below the band tolerance are dropped) */
+    static std::map<State, double> distribution(const K &kernel, const P &params, const State &start){
+      const int N = params.shared.population_size;
+      const double log_tolerance = std::log(params.fixed.exact_band_tolerance);
+      const std::vector<double> log_factorial = markov_chain::log_factorials(N);
+      const auto [raw_AA, raw_Aa, raw_aa] = kernel.genotype_weights(start);
+      // as in DSE::Kernel::step: AA ~ Bin(N, P(AA)), then Aa ~ Bin(N - AA, P(Aa | not AA))
+      const markov_chain::Binomial_Pmf homozygotes(N, raw_AA / (raw_AA + raw_Aa + raw_aa), log_factorial);
+      std::map<State, double> states;
+      const auto [lo, hi] = homozygotes.band(log_tolerance);
+      for (int AA = lo; AA <= hi; AA++){
+	const markov_chain::Binomial_Pmf heterozygotes(N - AA, raw_Aa / (raw_Aa + raw_aa), log_factorial);
+	const auto [Aa_lo, Aa_hi] = heterozygotes.band(log_tolerance);
+	for (int Aa = Aa_lo; Aa <= Aa_hi; Aa++){
+	  states[State {AA, Aa}] = std::exp(homozygotes.log_pmf(AA) + heterozygotes.log_pmf(Aa));
+	}
+      }
+      return states;
+    }
+    static void add(std::vector<State> &states, std::vector<double> &probabilities, const State &state,
+		    const double probability){
+      if (probability > 0.0){
+	states.push_back(state);
+	probabilities.push_back(probability);
+      }
+    }
+
+    std::vector<State> common, only_AA, only_Aa;
+    alias_table::Alias_Table common_table, only_AA_table, only_Aa_table;
+    double overlap = 0.0;
+  };
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+/**
+   @file haploid_kernel.h
+   @brief Per-generation kernel shared by the single-environment haploid models (HSE and HTEOE)
+*/
+
+#ifndef HAPLOID_KERNEL_H
+#define HAPLOID_KERNEL_H
+
+#include <array>
+#include <cmath>
+#include <vector>
+#include "trait_freq.h"
+#include "binomial.h"
+
+/**
+   @brief Namespace for the kernel of the single-environment haploid models
+   @details HSE and HTEOE differ only in how their parameters give the allele fitnesses wA and wa (one effect or
+   the sum of two), so they share one kernel, which each aliases as its Kernel.
+*/
+namespace haploid_kernel {
+  /**
+     @brief Per-generation kernel of a Wright-Fisher haploid model with one locus, two alleles and one environment
+     @details Constants are fixed at construction (N and the allele fitnesses wA and wa). With c copies of allele A,
+     the expected frequency of A after selection is c * wA / (c * wA + (N - c) * wa), which is then used as the
+     probability for a (random) binomial sampling process to get the new count. (The fitnesses are kept rather
+     than their ratio so that a lethal resident, wa = 0, gives A fixation rather than a division by zero.)
+     @tparam P Parameters of the model (parameters::HSE_Model_Parameters or parameters::HTEOE_Model_Parameters)
+  */
+  template <class P>
+  struct Single_Environment {
+    using Parameters = P;
+    static constexpr int number_environments = 1;
+    const int population_size; /**< Number of individuals in the population */
+    const double fitness_A; /**< wA */
+    const double fitness_a; /**< wa */
+
+    /** @param[in] fitnesses Allele fitnesses [wA, wa] (from the model's get_fitness_function) */
+    Single_Environment(const Parameters &parameters, const std::vector<double> &fitnesses)
+      : population_size(parameters.shared.population_size), fitness_A(fitnesses[0]), fitness_a(fitnesses[1]) {}
+    /** @brief Environment in generation \p gen (a single environment, so always 0) */
+    int environment(const int) const {
+      return 0;
+    }
+    /** @brief Expected frequency of allele A after selection, given \p count A alleles in generation \p gen */
+    double expectation(const int count, const int) const {
+      const double raw_A = count * fitness_A;
+      return raw_A / (raw_A + (population_size - count) * fitness_a);
+    }
+    /** @brief Expected frequency of allele A after selection in environment \p env */
+    double expectation_in_environment(const int count, const int) const {
+      return expectation(count, 0);
+    }
+    /**
+       @brief Mean and variance of the frequency of allele A in the next generation, given frequency \p freq in
+       environment \p env (the diffusion limit used by backward_equation)
+    */
+    std::array<double, 2> frequency_moments(const double freq, const int) const {
+      const double raw_A = freq * fitness_A;
+      const double mean = raw_A / (raw_A + (1.0 - freq) * fitness_a);
+      return {mean, mean * (1.0 - mean) / population_size};
+    }
+    /** @brief Environment of every generation from \p gen on (-1 if it still changes; see absorbing_shortcut) */
+    int final_environment(const int) const {
+      return 0;
+    }
+    /** @brief Selection coefficient log(wA / wa) of the diffusion limit in environment \p env */
+    double selection_coefficient(const int) const {
+      return std::log(fitness_A / fitness_a);
+    }
+    /** @brief Advances \p trait_count by one generation (selection then binomial sampling) */
+    template <class R>
+    void step(trait_freq::trait_counts<Parameters> &trait_count, R &rng, const int gen) const {
+      trait_count[0] = binomial::sample(rng, population_size, expectation(trait_count[0], gen));
+    }
+  };
+
+}
+
+#endif
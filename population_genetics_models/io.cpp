@@ -1,3 +1,5 @@
+#include <mutex>
+#include <set>
 #include <string>
 #include <sstream>
 #include <filesystem>
@@ -28,7 +30,11 @@ namespace io {
   const std::string create_dir(const std::string_view &parent_dir, const std::string &dir){
     std::ostringstream dir_path;
     dir_path << parent_dir << dir << "/";
-    if (!std::filesystem::exists(dir_path.str())){
+    // checked once per process (a sweep writes every point to the same directory, from several threads)
+    static std::set<std::string> known_dirs;
+    static std::mutex known_dirs_mutex;
+    std::lock_guard<std::mutex> lock(known_dirs_mutex);
+    if (known_dirs.insert(dir_path.str()).second && !std::filesystem::exists(dir_path.str())){
       std::filesystem::create_directories(dir_path.str());
     }
     return dir_path.str();
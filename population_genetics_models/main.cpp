@@ -1,8 +1,14 @@
 #include "model_specification.h"
+#include "run_options.h"
 
 int main(int argc, char* argv[]){
   
-  specification::specify_and_run_model(argc, argv);
+  argc = run_options::parse_run_options(argc, argv); // strip --key=value options
+  if (run_options::get().manifest.empty()){
+    specification::specify_and_run_model(argc, argv);
+  } else {
+    specification::run_manifest(argv[0], run_options::get().manifest); // sweep: every point in this process
+  }
   
   return 0;
   
@@ -0,0 +1,53 @@
+#include <cassert>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "manifest.h"
+
+namespace manifest {
+
+  namespace {
+    /** @brief Splits \p text at any of the characters in \p separators (dropping empty fields) */
+    std::vector<std::string> split(const std::string &text, const std::string &separators){
+      std::vector<std::string> fields;
+      std::size_t begin = text.find_first_not_of(separators);
+      while (begin != std::string::npos){
+	const std::size_t end = text.find_first_of(separators, begin);
+	fields.push_back(text.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+	begin = text.find_first_not_of(separators, end);
+      }
+      return fields;
+    }
+  }
+
+  std::vector<std::vector<std::string>> read_points(const std::string &path){
+    std::ifstream file(path);
+    assert(file && "--manifest: cannot open the manifest");
+    std::vector<std::vector<std::string>> points;
+    std::string line;
+    while (std::getline(file, line)){
+      const std::vector<std::string> fields = split(line, " \t\r,");
+      if (fields.empty() || fields[0][0] == '#'){
+	continue;
+      }
+      // expand the lists of the line into every combination of their values (last field fastest)
+      std::vector<std::vector<std::string>> expanded {{}};
+      for (const std::string &field : fields){
+	assert(field.rfind("--", 0) != 0 && "--manifest: run options apply to the whole sweep, not to a point");
+	const std::vector<std::string> values = split(field, "|");
+	std::vector<std::vector<std::string>> next;
+	next.reserve(expanded.size() * values.size());
+	for (const std::vector<std::string> &prefix : expanded){
+	  for (const std::string &value : values){
+	    next.push_back(prefix);
+	    next.back().push_back(value);
+	  }
+	}
+	expanded.swap(next);
+      }
+      points.insert(points.end(), expanded.begin(), expanded.end());
+    }
+    return points;
+  }
+
+}
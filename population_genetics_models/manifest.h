@@ -0,0 +1,28 @@
+/**
+   @file manifest.h
+   @brief Reads the parameter points of a sweep (--manifest)
+*/
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <string>
+#include <vector>
+
+/**
+   @brief Namespace for sweep manifests
+   @details A manifest has one line per parameter point, holding the positional command line arguments of the point
+   (model identifier first, e.g. HSE QEF 1000 0.01 2) separated by whitespace or commas, so a CSV file can be used.
+   Blank lines and lines starting with # are skipped. A field of the form v1|v2|... is a list of values, and a line
+   with lists stands for every combination of their values (a compact grid, expanded with the last list varying
+   fastest). Run options apply to the whole sweep, so they cannot be given in the manifest.
+*/
+namespace manifest {
+  /**
+     @brief Reads the parameter points listed in the manifest at \p path
+     @return Positional arguments of each point (without the program name), in manifest order
+  */
+  std::vector<std::vector<std::string>> read_points(const std::string &path);
+
+}
+
+#endif
@@ -0,0 +1,331 @@
+/**
+   @file markov_chain.h
+   @brief Exact (Markov chain) solver for the extinction-time distribution of the haploid models
+*/
+#ifndef MARKOV_CHAIN_H
+#define MARKOV_CHAIN_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "include/example.pb.h"
+#include "Parameters.h"
+#include "trait_freq.h"
+#include "thread_pool.h"
+
+/**
+   @brief Namespace for the exact solver (--engine=exact)
+   @details For a haploid model the count of allele A is a Markov chain on 0..N with absorbing states 0 (loss)
+   and N (fixation). Transition i -> j has probability Binomial(N, p_i) at j, where p_i = K::expectation(i, gen).
+   Instead of simulating replicates, the probability distribution over counts is propagated one generation at a
+   time (a matrix-vector product), which gives the distribution of generation_of_extinction and number_reinvasions
+   that the QEF replicates estimate.
+   - transition probabilities are calculated from a log-factorial table; for each source state only the band of
+   destination states whose probability is at least Fixed_Parameters::exact_band_tolerance is kept
+   - the matrix is stored by destination (column), so each entry of the new distribution is a dot product over a
+   contiguous range of source states; blocks of columns are computed in parallel on the thread pool
+   - an invasion attempt stops at max_generations_per_sim or once the unresolved probability falls below
+   Fixed_Parameters::exact_convergence_tolerance
+   - N is limited to fixed_parameters::exact_max_population_size, as the matrix grows roughly as N^1.5 (the band
+   of a source state is of order sqrt(N) wide)
+
+   Probability lost to the band and to the early stop is recorded as "truncated_probability".
+*/
+namespace markov_chain {
+  /** @brief True for the model kernels that the exact solver supports (haploid: a single trait count) */
+  template <class K>
+  struct has_exact_solver : std::bool_constant<K::Parameters::number_traits == 1> {};
+  /**
+     @brief Banded transition matrix between the transient states 1..N-1 and all states 0..N, stored by column
+  */
+  struct Transition_Matrix {
+    std::vector<int> first_source; /**< First source state of column j */
+    std::vector<int> last_source; /**< Last source state of column j (< first_source[j] if the column is empty) */
+    std::vector<std::size_t> offset; /**< Index in \p values of the entry (first_source[j], j) */
+    std::vector<double> values; /**< P(i -> j) for i in [first_source[j], last_source[j]], column after column */
+  };
+  /**
+     @brief Returns log(k!) for k in [0, n]
+  */
+  inline std::vector<double> log_factorials(const int n){
+    std::vector<double> log_factorial(n + 1, 0.0);
+    for (int k = 2; k <= n; k++){
+      log_factorial[k] = log_factorial[k - 1] + std::log(static_cast<double>(k));
+    }
+    return log_factorial;
+  }
+  /**
+     @brief Binomial(n, p) distribution evaluated from a log-factorial table
+  */
+  class Binomial_Pmf {
+  public:
+    /** @param[in] log_factorial log(k!) for k in [0, n] (from log_factorials) */
+    Binomial_Pmf(const int n, const double p, const std::vector<double> &log_factorial)
+      : n(n), p(p), log_p(std::log(p)), log_q(std::log1p(-p)), log_factorial(&log_factorial) {}
+    /** @brief log P(X = j) */
+    double log_pmf(const int j) const {
+      if (p <= 0.0){
+	return j == 0 ? 0.0 : -HUGE_VAL;
+      }
+      if (p >= 1.0){
+	return j == n ? 0.0 : -HUGE_VAL;
+      }
+      const std::vector<double> &log_fact = *log_factorial;
+      return log_fact[n] - log_fact[j] - log_fact[n - j] + j * log_p + (n - j) * log_q;
+    }
+    /** @brief Smallest interval [lo, hi] around the mode outside which log P(X = j) < \p log_tolerance */
+    std::pair<int, int> band(const double log_tolerance) const {
+      const int mode = std::clamp(static_cast<int>(std::floor((n + 1) * p)), 0, n);
+      int lo = mode, hi = mode;
+      while (lo > 0 && log_pmf(lo - 1) >= log_tolerance){
+	lo--;
+      }
+      while (hi < n && log_pmf(hi + 1) >= log_tolerance){
+	hi++;
+      }
+      return {lo, hi};
+    }
+
+  private:
+    int n;
+    double p, log_p, log_q;
+    const std::vector<double>* log_factorial;
+  };
+  /**
+     @brief Builds the transition matrix of \p kernel in generation \p gen
+     @details Within a column, the source range is contiguous because the bands are widened to be monotone in i.
+  */
+  template <class K>
+  Transition_Matrix build_transition_matrix(const K &kernel, const typename K::Parameters &params, const int gen){
+    const int N = params.shared.population_size;
+    assert(N <= fixed_parameters::exact_max_population_size &&
+	   "--engine=exact needs N <= fixed_parameters::exact_max_population_size (use --engine=pde for larger N)");
+    const double log_tolerance = std::log(params.fixed.exact_band_tolerance);
+    const std::vector<double> log_factorial = log_factorials(N);
+    std::vector<Binomial_Pmf> row;
+    std::vector<int> lo(N + 1), hi(N + 1);
+    row.reserve(N + 1);
+    row.emplace_back(N, 0.0, log_factorial); // state 0 (absorbing, not used)
+    for (int i = 1; i < N; i++){
+      row.emplace_back(N, kernel.expectation(i, gen), log_factorial);
+      std::tie(lo[i], hi[i]) = row[i].band(log_tolerance);
+    }
+    for (int i = N - 2; i >= 1; i--){ // make both band edges non-decreasing in i
+      lo[i] = std::min(lo[i], lo[i + 1]);
+    }
+    for (int i = 2; i < N; i++){
+      hi[i] = std::max(hi[i], hi[i - 1]);
+    }
+    Transition_Matrix matrix {std::vector<int>(N + 1), std::vector<int>(N + 1), std::vector<std::size_t>(N + 1), {}};
+    int first = 1; // first source whose band reaches column j
+    int last = 0; // last source whose band starts at or before column j
+    for (int j = 0; j <= N; j++){
+      while (first < N && hi[first] < j){
+	first++;
+      }
+      while (last + 1 < N && lo[last + 1] <= j){
+	last++;
+      }
+      matrix.first_source[j] = first;
+      matrix.last_source[j] = last;
+      matrix.offset[j] = matrix.values.size();
+      for (int i = first; i <= last; i++){
+	matrix.values.push_back(std::exp(row[i].log_pmf(j)));
+      }
+    }
+    return matrix;
+  }
+  /**
+     @brief Outcome of one invasion attempt started from a distribution over counts
+  */
+  struct Attempt {
+    std::vector<double> extinct_by_gen; /**< P(trait lost in generation g) */
+    double extinct = 0.0; /**< P(trait lost) */
+    double truncated = 0.0; /**< Probability lost to the band and to the early stop */
+    std::vector<double> persisting; /**< P(count is j when the attempt ends with the trait present) */
+    double work = 0.0; /**< Multiply-adds of the propagation */
+    bool complete = true; /**< False if the propagation stopped at max_work (the other members are then partial) */
+  };
+  /**
+     @brief Propagates the distribution \p start (over counts 0..N) until absorption or max_generations_per_sim
+     @param[in, out] matrices Transition matrix of each environment (built when first needed)
+     @param[in] max_work Multiply-adds after which the propagation stops (Attempt::complete is then false)
+  */
+  template <class K>
+  Attempt run_attempt(const K &kernel, const typename K::Parameters &params, const std::vector<double> &start,
+		      std::vector<Transition_Matrix> &matrices, std::vector<bool> &built,
+		      const double max_work = HUGE_VAL){
+    const int N = params.shared.population_size;
+    const int max_gen = params.fixed.max_generations_per_sim;
+    constexpr int columns_per_task = fixed_parameters::exact_columns_per_task;
+    const int tasks = (N + columns_per_task) / columns_per_task;
+    Attempt attempt;
+    attempt.persisting.assign(N + 1, 0.0);
+    std::vector<double> current = start, next(N + 1, 0.0);
+    double start_mass = 0.0;
+    for (const double probability : start){
+      start_mass += probability;
+    }
+    double fixed = current[N];
+    const double lost_at_start = current[0]; // a replicate that starts without the trait is lost in gen 0
+    current[N] = 0.0;
+    current[0] = 0.0;
+    int support_lo = 1, support_hi = N - 1; // current is zero outside [support_lo, support_hi]
+    std::vector<double> task_mass(tasks), task_work(tasks);
+    std::vector<int> task_lo(tasks), task_hi(tasks);
+    double unresolved = 0.0;
+    for (int j = 1; j < N; j++){
+      unresolved += current[j];
+    }
+
+    for (int gen = 0; gen <= max_gen && unresolved >= params.fixed.exact_convergence_tolerance; gen++){
+      // the step into generation gen uses the environment of generation gen - 1 (as in invasion::trait_invasion)
+      const int env = kernel.environment(gen - 1);
+      if (env >= static_cast<int>(matrices.size())){
+	matrices.resize(env + 1);
+	built.resize(env + 1, false);
+      }
+      if (!built[env]){
+	matrices[env] = build_transition_matrix(kernel, params, gen - 1);
+	built[env] = true;
+      }
+      const Transition_Matrix &matrix = matrices[env];
+      thread_pool::get_pool().parallel_for(tasks, [&](int task){
+	const int begin = task * columns_per_task;
+	const int end = std::min(begin + columns_per_task, N + 1);
+	double mass = 0.0, work = 0.0;
+	int lo = N + 1, hi = -1;
+	for (int j = begin; j < end; j++){
+	  const int first = std::max(matrix.first_source[j], support_lo);
+	  const int last = std::min(matrix.last_source[j], support_hi);
+	  const double* column = matrix.values.data() + matrix.offset[j];
+	  const double* source = current.data() + matrix.first_source[j];
+	  const int length = last - matrix.first_source[j];
+	  double sum = 0.0;
+#pragma omp simd reduction(+:sum)
+	  for (int k = first - matrix.first_source[j]; k <= length; k++){
+	    sum += column[k] * source[k];
+	  }
+	  next[j] = sum;
+	  work += std::max(last - first + 1, 0);
+	  if (sum > 0.0 && j > 0 && j < N){
+	    mass += sum;
+	    lo = std::min(lo, j);
+	    hi = std::max(hi, j);
+	  }
+	}
+	task_mass[task] = mass;
+	task_work[task] = work;
+	task_lo[task] = lo;
+	task_hi[task] = hi;
+      });
+      attempt.extinct_by_gen.push_back(next[0]);
+      fixed += next[N];
+      next[0] = 0.0;
+      next[N] = 0.0;
+      // reduce in task order (the result does not depend on the number of threads)
+      unresolved = 0.0;
+      support_lo = N;
+      support_hi = 0;
+      for (int task = 0; task < tasks; task++){
+	unresolved += task_mass[task];
+	attempt.work += task_work[task];
+	support_lo = std::min(support_lo, task_lo[task]);
+	support_hi = std::max(support_hi, task_hi[task]);
+      }
+      current.swap(next);
+      if (gen == max_gen){ // the trait persists in the replicates that are unresolved at the max gen
+	for (int j = 1; j < N; j++){
+	  attempt.persisting[j] = current[j];
+	}
+	unresolved = 0.0;
+      }
+      if (attempt.work > max_work){
+	attempt.complete = false;
+	return attempt;
+      }
+    }
+    if (attempt.extinct_by_gen.empty()){
+      attempt.extinct_by_gen.push_back(0.0);
+    }
+    attempt.extinct_by_gen[0] += lost_at_start;
+    attempt.persisting[N] = fixed;
+    double persists = 0.0;
+    for (const double probability : attempt.extinct_by_gen){
+      attempt.extinct += probability;
+    }
+    for (const double probability : attempt.persisting){
+      persists += probability;
+    }
+    attempt.truncated = std::max(0.0, start_mass - attempt.extinct - persists);
+    return attempt;
+  }
+  /**
+     @brief Calculates the exact distributions of generation_of_extinction and number_reinvasions
+     @details Writes (all FloatList):
+     - "generation_of_extinction_probability": element g is P(trait lost in generation g)
+     - "trait_persists_probability": P(trait fixed or present at the max gen), which the replicates record as
+     generation_of_extinction == max_generations_per_sim
+     - "number_reinvasions_probability": element k is P(number_reinvasions == k - 1) (see record_data)
+     - "truncated_probability": probability not accounted for because of the tolerances
+  */
+  template <class K>
+  void calculate(const K &kernel, const typename K::Parameters &params,
+		 google::protobuf::Map<std::string, tensorflow::Feature>* feature_map){
+    const int N = params.shared.population_size;
+    const int invader_count = trait_freq::invader_count(params);
+    std::vector<Transition_Matrix> matrices;
+    std::vector<bool> built;
+    std::vector<double> start(N + 1, 0.0);
+    start[std::clamp(invader_count, 0, N)] = 1.0;
+    Attempt attempt = run_attempt(kernel, params, start, matrices, built);
+    double truncated = attempt.truncated;
+
+    tensorflow::Feature gen_extinct = tensorflow::Feature();
+    std::vector<double> &extinct_by_gen = attempt.extinct_by_gen;
+    while (!extinct_by_gen.empty() && extinct_by_gen.back() == 0.0){
+      extinct_by_gen.pop_back();
+    }
+    gen_extinct.mutable_float_list()->mutable_value()->Add(extinct_by_gen.begin(), extinct_by_gen.end());
+    double persists = 0.0;
+    for (const double probability : attempt.persisting){
+      persists += probability;
+    }
+    tensorflow::Feature trait_persists = tensorflow::Feature();
+    trait_persists.mutable_float_list()->add_value(persists);
+
+    // reinvasion attempts start from the persisting distribution with invader_count individuals replaced
+    tensorflow::Feature reinvasions = tensorflow::Feature();
+    tensorflow::FloatList* reinvasion_probability = reinvasions.mutable_float_list();
+    reinvasion_probability->add_value(attempt.extinct); // -1: lost in the initial invasion
+    for (int reinvasion = 0; reinvasion < params.shared.number_reinvasions; reinvasion++){
+      std::fill(start.begin(), start.end(), 0.0);
+      for (int j = 1; j <= N; j++){
+	start[std::max(j - invader_count, 0)] += attempt.persisting[j];
+      }
+      attempt = run_attempt(kernel, params, start, matrices, built);
+      truncated += attempt.truncated;
+      reinvasion_probability->add_value(attempt.extinct);
+    }
+    double survives_all = 0.0;
+    for (const double probability : attempt.persisting){
+      survives_all += probability;
+    }
+    reinvasion_probability->add_value(survives_all);
+    tensorflow::Feature truncation = tensorflow::Feature();
+    truncation.mutable_float_list()->add_value(truncated);
+
+    (*feature_map)["generation_of_extinction_probability"] = gen_extinct;
+    (*feature_map)["trait_persists_probability"] = trait_persists;
+    (*feature_map)["number_reinvasions_probability"] = reinvasions;
+    (*feature_map)["truncated_probability"] = truncation;
+  }
+
+}
+
+#endif
@@ -1,46 +1,146 @@
-#include <functional>
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "model_specification.h"
 #include "HSE.h"
 #include "HTE.h"
 #include "DSE.h"
 #include "HTEOE.h"
 #include "io.h"
+#include "manifest.h"
 #include "path_parameters.h"
+#include "rng.h"
+#include "run_options.h"
+#include "thread_pool.h"
 
 namespace specification {
+
+  namespace {
+    /** Registry of available models (fixed at compile time) */
+    constexpr std::array<Model_Entry, 4> model_registry {{
+	{"HSE", HSE::run_model, HSE::estimate_cost},
+	{"HTE", HTE::run_model, HTE::estimate_cost},
+	{"DSE", DSE::run_model, DSE::estimate_cost},
+	{"HTEOE", HTEOE::run_model, HTEOE::estimate_cost}
+      }};
+  }
   /**
-     @brief Constructs a \p std::map so that models can be called via a \p std::string argument
-     @return \p std::map with a \p std::string as "key" and a function that runs the model as "value"
+     @brief Looks up a model in the registry by its identifier
+     @param[in] name Model identifier (e.g. HSE)
+     @return Pointer to the registry entry, or nullptr if there is no model called \p name
   */
-  model_map get_model_map(){
-    model_map map {
-      {"HSE", HSE::run_model},
-      {"HTE", HTE::run_model},
-      {"DSE", DSE::run_model},
-      {"HTEOE", HTEOE::run_model}
-    };
-    return map;
+  const Model_Entry* find_model(std::string_view name){
+    for (const Model_Entry &entry : model_registry){
+      if (entry.name == name){
+	return &entry;
+      }
+    }
+    return nullptr;
   }
 
   /**
      @brief Specifies and runs one of the four models (HSE, DSE, HTE, HTEOE)
+     @details The model is looked up once; the chosen model's replicate loop is fully instantiated for its kernel.
      @param[in] argc Number of command line arguments
      @param[in] argv Array of command line arguments
      @return Nothing (but runs a specified model and combination of parameter values)
   **/
   void specify_and_run_model(int argc, char* argv[]){
-    model_map map = get_model_map(); // hashmap/dict of available models
-    try {
-      map[ argv[1] ](argc, argv); // specify and run model
-    }
-    catch (const std::bad_function_call &e){
+    const Model_Entry* model = argc > 1 ? find_model(argv[1]) : nullptr;
+    if (model == nullptr){
       const std::string error_file_path =
 	io::setup_dir_and_file(argc, argv, paths::error_file_directory, "_error.txt");
       std::ofstream error_file(error_file_path, std::ofstream::app);
-      error_file << "exception: " << e.what() << " - is the first cmdline argument the model identifier (e.g. HSE)?" << "\n";
+      error_file << "exception: unknown model - is the first cmdline argument the model identifier (e.g. HSE)?" << "\n";
+      return;
     }
-  
+    model->run_model(argc, argv); // specify and run model
+  }
+  /**
+     @brief Runs every parameter point of a sweep manifest in this process (--manifest; see manifest)
+     @details The points share the thread pool and the protobuf runtime, and each writes its own output file as
+     if it had been run on its own. Points are the outer tasks of the thread pool and their replicate chunks inner
+     tasks, so threads that run out of points help with the chunks of the points still running. Point i is seeded
+     with the i-th output of splitmix64 from the seed of the run options (each records the seed it used, so it can
+     be rerun alone with --seed), and its output does not depend on which threads ran it.
+
+     The cost of every point is estimated first (cost_model) and the points are started longest first, so that
+     the long points do not start last and leave the other threads idle at the end. The predicted wall time and
+     the predicted finish time of each point (assigning the points in that order to the first free thread, each
+     running on one thread) are printed before the points are run.
+     @param[in] program_name Name of the program (argv[0])
+     @param[in] path Path of the manifest
+     @return Nothing (but runs the listed models and combinations of parameter values)
+  **/
+  void run_manifest(char* program_name, const std::string &path){
+    const std::vector<std::vector<std::string>> points = manifest::read_points(path);
+    const int number_points = static_cast<int>(points.size());
+    std::vector<std::uint64_t> seeds;
+    std::uint64_t seed_state = run_options::get().seed;
+    for (int i = 0; i < number_points; i++){
+      seeds.push_back(rng::splitmix64(seed_state));
+    }
+    // calls f(argc, argv) with the arguments of point i
+    const auto with_point = [&](const int i, auto f){
+      std::vector<std::string> arguments(points[i]);
+      std::vector<char*> point_argv {program_name};
+      for (std::string &argument : arguments){
+	point_argv.push_back(argument.data());
+      }
+      point_argv.push_back(nullptr);
+      f(static_cast<int>(point_argv.size()) - 1, point_argv.data());
+    };
+
+    std::vector<double> costs(number_points, 0.0);
+    thread_pool::get_pool().parallel_for(number_points, [&](int i){
+      run_options::set_seed(seeds[i]);
+      with_point(i, [&](int argc, char* argv[]){
+	const Model_Entry* model = find_model(argv[1]);
+	costs[i] = model == nullptr ? 0.0 : model->estimate_cost(argc, argv); // unknown models only write an error
+      });
+    });
+    std::vector<int> order(number_points);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b){ return costs[a] > costs[b]; });
+
+    // predicted finish times: each point in order goes to the thread that is free first
+    std::priority_queue<double, std::vector<double>, std::greater<double>> free_at;
+    for (int thread = 0; thread < thread_pool::get_pool().size(); thread++){
+      free_at.push(0.0);
+    }
+    std::vector<double> finish(number_points);
+    double wall_time = 0.0;
+    for (const int i : order){
+      finish[i] = free_at.top() + costs[i];
+      free_at.pop();
+      free_at.push(finish[i]);
+      wall_time = std::max(wall_time, finish[i]);
+    }
+    std::cout << std::fixed << std::setprecision(1) << "manifest: " << number_points << " points, predicted wall time "
+	      << wall_time << " s on " << thread_pool::get_pool().size() << " threads (longest first)\n";
+    for (const int i : order){
+      std::cout << "  point " << i << ": cost " << costs[i] << " s, ETA " << finish[i] << " s:";
+      for (const std::string &argument : points[i]){
+	std::cout << " " << argument;
+      }
+      std::cout << "\n";
+    }
+    std::cout << std::flush;
+
+    thread_pool::get_pool().parallel_for(number_points, [&](int task){
+      const int i = order[task];
+      run_options::set_seed(seeds[i]);
+      with_point(i, specify_and_run_model);
+    });
   }
 
 }
@@ -6,17 +6,25 @@
 #ifndef MODEL_SPEC_H
 #define MODEL_SPEC_H
 
-#include <map>
+#include <array>
 #include <string>
-#include <functional>
+#include <string_view>
 
 namespace specification {
-  
-  /** alias for \p std::map that is used to choose which model to run */
-  using model_map = std::map<std::string, std::function<void(int, char*[])>>;
 
-  model_map get_model_map();
+  /**
+     Entry in the registry of models: the identifier given as the first cmdline argument, the function that runs it,
+     and the function that estimates its run time (see cost_model)
+  */
+  struct Model_Entry {
+    std::string_view name;
+    void (*run_model)(int, char*[]);
+    double (*estimate_cost)(int, char*[]);
+  };
+
+  const Model_Entry* find_model(std::string_view name);
   void specify_and_run_model(int argc, char* argv[]);
+  void run_manifest(char* program_name, const std::string &path);
 
 }
 
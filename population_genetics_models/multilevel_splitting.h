@@ -0,0 +1,292 @@
+/**
+   @file multilevel_splitting.h
+   @brief Fixed-effort multilevel splitting for rare persistence (--engine=splitting)
+*/
+#ifndef MULTILEVEL_SPLITTING_H
+#define MULTILEVEL_SPLITTING_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "include/example.pb.h"
+#include "Parameters.h"
+#include "conditional_existence_status.h"
+#include "environment_schedule.h"
+#include "record_data.h"
+#include "rng.h"
+#include "thread_pool.h"
+#include "trait_freq.h"
+#include "trait_invasion.h"
+
+/**
+   @brief Namespace for the multilevel splitting engine
+   @details When the trait almost never persists (e.g. a deleterious trait that has to fix and then resist many
+   reinvasions), the replicates are nearly all extinctions. Splitting estimates the rare outcome from a sequence of
+   stages, each run with the same number of trajectories (fixed_parameters::splitting_trajectories_per_stage):
+   - invasion stages: the copies of allele A must reach the next level (chosen by a pilot run so that each stage
+   is passed with probability about fixed_parameters::splitting_stage_probability; the last level is fixation);
+   an invasion that ends without the trait extinct (fixed, or still segregating at max_generations_per_sim) also
+   passes every level
+   - reinvasion stages: one per reinvasion attempt (simulated with invasion::trait_invasion, as with
+   --reinvasions=simulate), passed if the trait is not extinct after it
+
+   The trajectories of a stage start from the states in which the previous stage's successes entered it (each
+   cloned the same number of times, give or take one), and every chunk of a stage has its own stream of \p rng.
+   With p_k the fraction of successes of stage k, prod_k p_k is an unbiased estimate of the probability of
+   persisting through all the stages, with relative variance that grows with the number of stages rather than
+   with 1 / probability.
+
+   A trajectory that fails stage k is a leaf of weight (p_0 ... p_{k-1}) / n, and the trajectories that pass the
+   last stage are leaves of weight (p_0 ... p_K) / n, so the weights sum to 1. The leaves are written in the
+   per-replicate format (generation_of_extinction and number_reinvasions_before_extinction), with the weight of
+   each in "replicate_weight"; leaves of a stage with the same outcome are written once with their weights added.
+   Also written are "splitting_levels" (allele A copies of each invasion stage), "splitting_stage_probabilities"
+   (p_k) and "splitting_persistence_probability" (of persisting through the invasion, then through all the
+   reinvasions).
+
+   The per-generation step of the invasion stages is the kernel's own, so --sampler and --shortcut do not apply,
+   and HTE environment schedules must be deterministic.
+*/
+namespace multilevel_splitting {
+  /**
+     @brief State of a trajectory (where it entered the current stage)
+  */
+  template <class P>
+  struct Trajectory {
+    trait_freq::trait_counts<P> trait_count;
+    int gen;
+  };
+  /**
+     @brief Runs an invasion until allele A reaches \p level copies or the invasion ends
+     @return True if the level was reached or the invasion ended without the trait extinct
+  */
+  template <class K, class R>
+  bool run_to_level(const K &kernel, const typename K::Parameters &params, R &rng,
+		    Trajectory<typename K::Parameters> &trajectory, const int level){
+    auto ended = [&](){
+      return conditional_existence_status::allele_A_extinct(trajectory.trait_count, params) ||
+	conditional_existence_status::allele_A_fixed(trajectory.trait_count, params) ||
+	conditional_existence_status::reached_max_gen(trajectory.gen, params);
+    };
+    // a trajectory that entered at the end of the invasion, or beyond \p level, has passed (the initial state has not)
+    if (trajectory.gen >= 0){
+      if (ended()){
+	return !conditional_existence_status::trait_extinct(trajectory.trait_count, params);
+      }
+      if (conditional_existence_status::allele_A_copies(trajectory.trait_count) >= level){
+	return true;
+      }
+    }
+    do {
+      kernel.step(trajectory.trait_count, rng, trajectory.gen);
+      ++trajectory.gen;
+      if (ended()){
+	return !conditional_existence_status::trait_extinct(trajectory.trait_count, params);
+      }
+    }
+    while (conditional_existence_status::allele_A_copies(trajectory.trait_count) < level);
+    return true;
+  }
+  /**
+     @brief Highest number of copies of allele A that an invasion from \p trajectory reaches before it ends
+  */
+  template <class K, class R>
+  int highest_copies(const K &kernel, const typename K::Parameters &params, R &rng,
+		     Trajectory<typename K::Parameters> trajectory){
+    int highest = conditional_existence_status::allele_A_copies(trajectory.trait_count);
+    auto ended = [&](){
+      return conditional_existence_status::allele_A_extinct(trajectory.trait_count, params) ||
+	conditional_existence_status::allele_A_fixed(trajectory.trait_count, params) ||
+	conditional_existence_status::reached_max_gen(trajectory.gen, params);
+    };
+    if (trajectory.gen >= 0 && ended()){
+      return highest;
+    }
+    do {
+      kernel.step(trajectory.trait_count, rng, trajectory.gen);
+      ++trajectory.gen;
+      highest = std::max(highest, conditional_existence_status::allele_A_copies(trajectory.trait_count));
+    }
+    while (!ended());
+    return highest;
+  }
+  /** @brief Number of chunks of a stage of \p n trajectories */
+  template <class P>
+  int number_chunks(const P &params, const int n){
+    return (n + params.fixed.replicates_per_chunk - 1) / params.fixed.replicates_per_chunk;
+  }
+  /**
+     @brief Runs one stage: \p n trajectories, trajectory i starting from entrances[i % entrances.size()]
+     @details The chunks of the stage are run on the thread pool, chunk c with the c-th stream after \p stream_root
+     (which is then moved past the streams of the stage).
+     @param[in] run_trajectory run_trajectory(rng, trajectory, chunk, i) runs trajectory i (in chunk) and returns
+     true if it passed the stage
+     @return States of the trajectories that passed the stage (in the order of i)
+  */
+  template <class P, class R, class F>
+  std::vector<Trajectory<P>> run_stage(const P &params, const std::vector<Trajectory<P>> &entrances, const int n,
+				       R &stream_root, F run_trajectory){
+    const int chunks = number_chunks(params, n);
+    std::vector<R> chunk_rng = rng::make_streams(stream_root, chunks);
+    stream_root = chunk_rng.back();
+    std::vector<std::vector<Trajectory<P>>> chunk_successes(chunks);
+
+    thread_pool::get_pool().parallel_for(chunks, [&](int chunk){
+      const int first = chunk * params.fixed.replicates_per_chunk;
+      const int last = std::min(first + params.fixed.replicates_per_chunk, n);
+      for (int i = first; i < last; i++){
+	Trajectory<P> trajectory = entrances[i % entrances.size()];
+	if (run_trajectory(chunk_rng[chunk], trajectory, chunk, i)){
+	  chunk_successes[chunk].push_back(trajectory);
+	}
+      }
+    });
+    std::vector<Trajectory<P>> successes;
+    for (int chunk = 0; chunk < chunks; chunk++){
+      successes.insert(successes.end(), chunk_successes[chunk].begin(), chunk_successes[chunk].end());
+    }
+    return successes;
+  }
+  /**
+     @brief Chooses the levels (allele A copies) of the invasion stages from a pilot run
+     @details Each level is the number of copies reached by a fraction fixed_parameters::splitting_stage_probability
+     of fixed_parameters::splitting_pilot_trajectories pilot invasions from the previous level (at least one copy
+     more), and the last level is fixation. The pilot uses its own streams (from \p stream_root), so the levels
+     are fixed before the stages are run and the estimate stays unbiased.
+  */
+  template <class K, class R>
+  std::vector<int> levels(const K &kernel, const typename K::Parameters &params, R &stream_root){
+    using P = typename K::Parameters;
+    const int n = fixed_parameters::splitting_pilot_trajectories;
+    const int fixation = P::ploidy * params.shared.population_size;
+    std::vector<Trajectory<P>> entrances {{trait_freq::initialise_trait_counts(params), -1}};
+    int level = conditional_existence_status::allele_A_copies(entrances[0].trait_count);
+    std::vector<int> level_copies;
+    while (!entrances.empty()){
+      std::vector<int> highest(n);
+      run_stage(params, entrances, n, stream_root, [&](R &rng, Trajectory<P> &trajectory, int, int i){
+	highest[i] = highest_copies(kernel, params, rng, trajectory);
+	return false;
+      });
+      const int k = std::max(0, static_cast<int>(std::ceil(fixed_parameters::splitting_stage_probability * n)) - 1);
+      std::nth_element(highest.begin(), highest.begin() + k, highest.end(), std::greater<int>());
+      level = std::max(highest[k], level + 1);
+      if (level >= fixation){
+	break;
+      }
+      level_copies.push_back(level);
+      entrances = run_stage(params, entrances, n, stream_root, [&](R &rng, Trajectory<P> &trajectory, int, int){
+	return run_to_level(kernel, params, rng, trajectory, level);
+      });
+    }
+    level_copies.push_back(fixation);
+    return level_copies;
+  }
+  /**
+     @brief Runs the splitting stages and writes the weighted leaves and the estimates
+     @param[in, out] rng Random number engine (the root of the streams of the pilot and of every stage)
+     @param[out] gen_extinct Generation of extinction of each leaf
+     @param[out] reinvasion_number Number of reinvasions of each leaf
+     @param[out] feature_map Map to which replicate_weight and the splitting features are written
+  */
+  template <class K, class R>
+  void calculate(const K &kernel, const typename K::Parameters &params, R &rng, tensorflow::Int64List* gen_extinct,
+		 tensorflow::Int64List* reinvasion_number,
+		 google::protobuf::Map<std::string, tensorflow::Feature>* feature_map){
+    using P = typename K::Parameters;
+    using Leaves = std::map<std::pair<std::int64_t, std::int64_t>, std::int64_t>;
+    if constexpr (environment_schedule::has_schedule<K>::value){
+      assert(kernel.schedule.deterministic() && "--engine=splitting needs a deterministic --environment_schedule");
+    }
+    R stream_root = rng;
+    const invasion::Shortcuts<K> shortcuts(kernel, params);
+    const std::vector<int> level_copies = levels(kernel, params, stream_root);
+    const int n = fixed_parameters::splitting_trajectories_per_stage;
+    const int invasion_stages = static_cast<int>(level_copies.size());
+    const int stages = invasion_stages + std::max(params.shared.number_reinvasions, 0);
+
+    std::vector<Trajectory<P>> entrances {{trait_freq::initialise_trait_counts(params), -1}};
+    std::vector<double> stage_probability;
+    double weight = 1.0 / n; // of a leaf of the current stage
+    tensorflow::Feature replicate_weights = tensorflow::Feature();
+    tensorflow::FloatList* replicate_weight = replicate_weights.mutable_float_list();
+    // leaves: (generation of extinction, number of reinvasions) -> number of trajectories
+    auto write_leaves = [&](const Leaves &leaves){
+      for (const auto &[outcome, number] : leaves){
+	gen_extinct->add_value(outcome.first);
+	reinvasion_number->add_value(outcome.second);
+	replicate_weight->add_value(number * weight);
+      }
+    };
+    for (int stage = 0; stage < stages && !entrances.empty(); stage++){
+      std::vector<Leaves> chunk_leaves(number_chunks(params, n));
+      if (stage < invasion_stages){
+	entrances = run_stage(params, entrances, n, stream_root, [&](R &chunk_rng, Trajectory<P> &trajectory, int chunk, int){
+	  if (run_to_level(kernel, params, chunk_rng, trajectory, level_copies[stage])){
+	    return true;
+	  }
+	  tensorflow::Int64List leaf;
+	  record_data::generation_trait_extinction(&leaf, trajectory.trait_count, params, trajectory.gen);
+	  chunk_leaves[chunk][{leaf.value(0), -1}]++;
+	  return false;
+	});
+      } else {
+	// reinvasion attempt stage - invasion_stages + 1 (as in conditional_existence_probability::record_and_reinvade)
+	entrances = run_stage(params, entrances, n, stream_root, [&](R &chunk_rng, Trajectory<P> &trajectory, int chunk, int){
+	  trajectory.gen = -1;
+	  trajectory.trait_count[ params.shared.trait_info[0] ] -= trait_freq::invader_count(params);
+	  invasion::trait_invasion(kernel, params, shortcuts, chunk_rng, trajectory.trait_count, trajectory.gen);
+	  if (!conditional_existence_status::trait_extinct(trajectory.trait_count, params)){
+	    return true;
+	  }
+	  chunk_leaves[chunk][{params.fixed.max_generations_per_sim, stage - invasion_stages}]++;
+	  return false;
+	});
+      }
+      Leaves leaves;
+      for (const Leaves &chunk : chunk_leaves){
+	for (const auto &[outcome, number] : chunk){
+	  leaves[outcome] += number;
+	}
+      }
+      write_leaves(leaves);
+      stage_probability.push_back(static_cast<double>(entrances.size()) / n);
+      weight *= stage_probability.back();
+    }
+    // trajectories that pass every stage persist through the invasion and all the reinvasions
+    if (!entrances.empty()){
+      write_leaves({{{params.fixed.max_generations_per_sim, std::max(params.shared.number_reinvasions, 0)}, n}});
+    }
+
+    tensorflow::Feature levels_feature = tensorflow::Feature();
+    for (const int level : level_copies){
+      levels_feature.mutable_int64_list()->add_value(level);
+    }
+    // stages after one without successes were not run (probability 0)
+    stage_probability.resize(stages, 0.0);
+    tensorflow::Feature probabilities = tensorflow::Feature();
+    double persistence = 1.0;
+    tensorflow::Feature persistence_feature = tensorflow::Feature();
+    for (int stage = 0; stage < stages; stage++){
+      probabilities.mutable_float_list()->add_value(stage_probability[stage]);
+      persistence *= stage_probability[stage];
+      if (stage == invasion_stages - 1){
+	persistence_feature.mutable_float_list()->add_value(persistence); // through the invasion
+      }
+    }
+    persistence_feature.mutable_float_list()->add_value(persistence); // through all the reinvasions
+    (*feature_map)["replicate_weight"] = replicate_weights;
+    (*feature_map)["splitting_levels"] = levels_feature;
+    (*feature_map)["splitting_stage_probabilities"] = probabilities;
+    (*feature_map)["splitting_persistence_probability"] = persistence_feature;
+  }
+
+}
+
+#endif
@@ -0,0 +1,252 @@
+/**
+   @file quasi_stationary.h
+   @brief Resolves invasion attempts that have settled at a stable polymorphism (--quasi_stationary=on)
+*/
+#ifndef QUASI_STATIONARY_H
+#define QUASI_STATIONARY_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <vector>
+#include "Parameters.h"
+#include "binomial.h"
+#include "conditional_existence_status.h"
+#include "run_options.h"
+#include "trait_freq.h"
+
+/**
+   @brief Namespace for quasi-stationary detection
+   @details When selection maintains allele A at an interior equilibrium p* (e.g. DSE with heterozygote
+   advantage), an invasion attempt hovers around p* until drift eventually carries it to loss or fixation, which
+   usually takes longer than max_generations_per_sim. Such attempts cost max_generations_per_sim generations each.
+
+   An attempt is watched in windows of fixed_parameters::quasi_stationary_window generations. It is taken to be
+   quasi-stationary once the environment no longer changes (K::final_environment), the drift of the allele A
+   frequency has a stable root p*, and the mean frequency of two consecutive windows is within 3 standard
+   deviations of p* (and within 2 of each other), where the standard deviation is that of the Ornstein-Uhlenbeck
+   approximation around p*. From the quasi-stationary distribution, the time to absorption is (approximately)
+   exponential with rate 1 / T(p*), and absorption is by fixation with probability u(p*), where T and u are the
+   mean absorption time and fixation probability of the diffusion limit (K::frequency_moments; Ewens 2004, 4.21).
+   The attempt then jumps to its outcome: absorption (loss or fixation) after an exponential time, or
+   persistence if that time passes max_generations_per_sim, in which case the counts are left as they are (a
+   typical quasi-stationary state). Shallow wells (T(p*) below fixed_parameters::quasi_stationary_min_escape_windows
+   windows) are simulated as usual.
+*/
+namespace quasi_stationary {
+  /**
+     @brief Escape from the quasi-stationary distribution around a stable equilibrium
+  */
+  struct Escape {
+    double rate; /**< Probability per generation of absorption (1 / T(p*)) */
+    double fixation_probability; /**< P(absorption is by fixation of allele A) */
+  };
+  /**
+     @brief Stable equilibrium of the allele A frequency
+  */
+  struct Equilibrium {
+    double frequency; /**< p* */
+    double standard_deviation; /**< Standard deviation of the frequency around p* (Ornstein-Uhlenbeck) */
+  };
+  /** @brief Expected change in the allele A frequency over one generation in environment \p env */
+  template <class K>
+  double drift(const K &kernel, const double freq, const int env){
+    return kernel.frequency_moments(freq, env)[0] - freq;
+  }
+  /**
+     @brief Finds a stable interior root of the drift (positive below it, negative above)
+     @return The equilibrium, or nothing if there is none (e.g. the haploid models, whose drift has one sign)
+  */
+  template <class K>
+  std::optional<Equilibrium> stable_equilibrium(const K &kernel, const int env){
+    constexpr int scan_points = 1024;
+    for (int i = 1; i < scan_points - 1; i++){
+      double lo = static_cast<double>(i) / scan_points;
+      double hi = static_cast<double>(i + 1) / scan_points;
+      if (!(drift(kernel, lo, env) > 0.0 && drift(kernel, hi, env) <= 0.0)){
+	continue;
+      }
+      for (int iteration = 0; iteration < 60; iteration++){
+	const double mid = 0.5 * (lo + hi);
+	(drift(kernel, mid, env) > 0.0 ? lo : hi) = mid;
+      }
+      const double p = 0.5 * (lo + hi);
+      const double delta = 1e-4;
+      const double restoring_rate = (drift(kernel, p - delta, env) - drift(kernel, p + delta, env)) / (2.0 * delta);
+      if (!(restoring_rate > 0.0)){
+	return std::nullopt;
+      }
+      const double variance = kernel.frequency_moments(p, env)[1];
+      return Equilibrium {p, std::sqrt(variance / (2.0 * restoring_rate))};
+    }
+    return std::nullopt;
+  }
+  /** @brief log(exp(a) + exp(b)) */
+  inline double log_add(const double a, const double b){
+    if (a == -std::numeric_limits<double>::infinity()){
+      return b;
+    }
+    const double high = std::max(a, b);
+    return high + std::log1p(std::exp(std::min(a, b) - high));
+  }
+  /**
+     @brief Escape rate and fixation probability of the diffusion limit started at \p equilibrium
+     @details Quadrature on fixed_parameters::quasi_stationary_grid_intervals midpoints, in logs (the scale
+     density exp(-int 2 M / V) grows like exp(N s) away from p*).
+  */
+  template <class K>
+  Escape escape(const K &kernel, const int env, const double equilibrium){
+    const int n = fixed_parameters::quasi_stationary_grid_intervals;
+    const double h = 1.0 / n;
+    const double minus_infinity = -std::numeric_limits<double>::infinity();
+    std::vector<double> log_variance(n), log_scale(n);
+    std::vector<double> slope(n); // 2 M / V
+    for (int j = 0; j < n; j++){
+      const double y = (j + 0.5) * h;
+      const auto [mean, variance] = kernel.frequency_moments(y, env);
+      log_variance[j] = std::log(variance);
+      slope[j] = 2.0 * (mean - y) / variance;
+    }
+    // log scale density, 0 at the node nearest p*
+    const int anchor = std::clamp(static_cast<int>(equilibrium * n), 0, n - 1);
+    log_scale[anchor] = 0.0;
+    for (int j = anchor + 1; j < n; j++){
+      log_scale[j] = log_scale[j - 1] - 0.5 * h * (slope[j - 1] + slope[j]);
+    }
+    for (int j = anchor - 1; j >= 0; j--){
+      log_scale[j] = log_scale[j + 1] + 0.5 * h * (slope[j] + slope[j + 1]);
+    }
+    // log S(y_j) = log int_0^y_j psi and log (S(1) - S(y_j)) (midpoint rule, half a cell at y_j)
+    std::vector<double> log_below(n), log_above(n);
+    double cumulative = minus_infinity;
+    for (int j = 0; j < n; j++){
+      log_below[j] = log_add(cumulative, std::log(0.5 * h) + log_scale[j]);
+      cumulative = log_add(cumulative, std::log(h) + log_scale[j]);
+    }
+    const double log_total = cumulative;
+    cumulative = minus_infinity;
+    for (int j = n - 1; j >= 0; j--){
+      log_above[j] = log_add(cumulative, std::log(0.5 * h) + log_scale[j]);
+      cumulative = log_add(cumulative, std::log(h) + log_scale[j]);
+    }
+    // T(p) = int t(p, y) dy with t = 2 (S(1) - S(p)) S(y) / (S(1) V psi) below p, 2 S(p) (S(1) - S(y)) / (S(1) V psi) above
+    double log_time = minus_infinity;
+    for (int j = 0; j < n; j++){
+      const double log_factor = j <= anchor ? log_above[anchor] + log_below[j] : log_below[anchor] + log_above[j];
+      log_time = log_add(log_time, std::log(2.0 * h) + log_factor - log_total - log_variance[j] - log_scale[j]);
+    }
+    return Escape {std::exp(-log_time), std::exp(log_below[anchor] - log_total)};
+  }
+  /**
+     @brief Stable equilibrium of one environment and the escape from it
+  */
+  struct Well {
+    Equilibrium equilibrium;
+    Escape escape_from;
+  };
+  /**
+     @brief Wells of a kernel, one per environment
+     @details The equilibria and escapes depend only on the kernel, so they are calculated once per parameter set
+     (and shared by every attempt and thread) rather than by every attempt that reaches a window. An environment
+     has no well if its drift has no stable root or if the well is shallow (simulated as usual); with
+     --quasi_stationary=off nothing is calculated and no environment has one.
+  */
+  template <class K>
+  class Wells {
+  public:
+    Wells(const K &kernel, const typename K::Parameters &params)
+      : enabled(run_options::get().quasi_stationary),
+	copies(K::Parameters::ploidy * params.shared.population_size) {
+      if (!enabled){
+	return;
+      }
+      for (int env = 0; env < K::number_environments; env++){
+	const std::optional<Equilibrium> equilibrium = stable_equilibrium(kernel, env);
+	if (!equilibrium.has_value()){
+	  continue;
+	}
+	const Escape escape_from = escape(kernel, env, equilibrium->frequency);
+	if (escape_from.rate * fixed_parameters::quasi_stationary_window *
+	    fixed_parameters::quasi_stationary_min_escape_windows < 1.0){
+	  wells[env] = Well {*equilibrium, escape_from};
+	}
+      }
+    }
+    /** @brief Well of environment \p env (nullptr if it has none) */
+    const Well* find(const int env) const {
+      return wells[env].has_value() ? &*wells[env] : nullptr;
+    }
+
+    const bool enabled;
+    const int copies; /**< Number of alleles in the population */
+
+  private:
+    std::array<std::optional<Well>, K::number_environments> wells;
+  };
+  /**
+     @brief Watches one invasion attempt for a quasi-stationary regime and resolves it once it is found
+  */
+  template <class K>
+  class Monitor {
+  public:
+    explicit Monitor(const Wells<K> &wells) : wells(wells) {}
+    /**
+       @brief Adds generation \p gen (with the attempt still running) to the window and, if the attempt is
+       quasi-stationary, jumps \p trait_count and \p gen to its outcome
+       @return True if the attempt jumped (it is then extinct, fixed or at max_generations_per_sim)
+    */
+    template <class R>
+    bool resolve(const K &kernel, const typename K::Parameters &params, R &rng,
+		 trait_freq::trait_counts<typename K::Parameters> &trait_count, int &gen){
+      if (!wells.enabled){
+	return false;
+      }
+      window_sum += static_cast<double>(conditional_existence_status::allele_A_copies(trait_count)) / wells.copies;
+      if (++window_length < fixed_parameters::quasi_stationary_window){
+	return false;
+      }
+      const double window_mean = window_sum / window_length;
+      window_sum = 0.0;
+      window_length = 0;
+      const double previous_mean = last_mean;
+      last_mean = window_mean;
+      const int env = kernel.final_environment(gen);
+      if (env < 0 || std::isnan(previous_mean)){
+	return false;
+      }
+      const Well* well = wells.find(env);
+      if (well == nullptr){
+	return false;
+      }
+      const double p = well->equilibrium.frequency;
+      const double sd = well->equilibrium.standard_deviation;
+      if (std::fabs(window_mean - p) > 3.0 * sd || std::fabs(previous_mean - p) > 3.0 * sd ||
+	  std::fabs(window_mean - previous_mean) > 2.0 * sd){
+	return false;
+      }
+      // generations until absorption (exponential, at least 1)
+      const double wait = std::ceil(-std::log1p(-binomial::uniform_01(rng)) / well->escape_from.rate);
+      const int max_gen = params.fixed.max_generations_per_sim;
+      if (wait >= max_gen - gen){
+	gen = max_gen;
+      } else {
+	gen += static_cast<int>(wait);
+	const bool fixed = binomial::uniform_01(rng) < well->escape_from.fixation_probability;
+	trait_count.fill(0);
+	trait_count[0] = fixed ? params.shared.population_size : 0; // all A (haploid) or all AA (diploid)
+      }
+      return true;
+    }
+
+  private:
+    const Wells<K> &wells;
+    double window_sum = 0.0;
+    int window_length = 0;
+    double last_mean = std::numeric_limits<double>::quiet_NaN();
+  };
+
+}
+
+#endif
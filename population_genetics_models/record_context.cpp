@@ -2,6 +2,9 @@
 #include "record_context.h"
 #include "include/example.pb.h"
 #include "Parameters.h"
+#include "HTE.h"
+#include "environment_schedule.h"
+#include "run_options.h"
 
 namespace record_context {
   
@@ -51,6 +54,10 @@ namespace record_context {
     tensorflow::Int64List* gen_env_1 = gen_e1.mutable_int64_list();
     gen_env_1->add_value(params.model.gen_env_1);
     (*map)["gen_env_1"] = gen_e1;
+
+    const environment_schedule::Schedule schedule(run_options::get().environment_schedule, params.model.gen_env_1,
+						  HTE::Kernel::number_environments);
+    schedule.record(map);
   }
 
   void add_specific_parameters_to_protobuf(google::protobuf::Map<std::string, tensorflow::Feature>* map,
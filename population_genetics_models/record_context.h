@@ -1,8 +1,10 @@
 #ifndef RECORD_CONTEXT_H
 #define RECORD_CONTEXT_H
 
+#include <string>
 #include "include/example.pb.h"
 #include "Parameters.h"
+#include "run_options.h"
 
 namespace record_context {
 
@@ -15,9 +17,12 @@ namespace record_context {
   void add_specific_parameters_to_protobuf(google::protobuf::Map<std::string, tensorflow::Feature>* map,
 					   parameters::HTEOE_Model_Parameters params);
 
+  /**
+     @param[in] engine Engine that produced the data (the one dispatched, which --engine does not always name)
+  */
   template<class P>
   void add_shared_parameters_to_protobuf(google::protobuf::Map<std::string, tensorflow::Feature>* map,
-					 P params, char* argv[]){
+					 P params, char* argv[], const std::string &engine){
     tensorflow::Feature model = tensorflow::Feature();
     tensorflow::BytesList* model_name = model.mutable_bytes_list();
     model_name->add_value(std::string(argv[1]));
@@ -43,13 +48,57 @@ namespace record_context {
     trait_info->add_value(params.shared.trait_info[0]);
     trait_info->add_value(params.shared.trait_info[1]);
     (*map)["trait_info"] = trait;
+
+    const run_options::Run_Options &options = run_options::get();
+    tensorflow::Feature seed = tensorflow::Feature();
+    tensorflow::Int64List* rng_seed = seed.mutable_int64_list();
+    rng_seed->add_value(static_cast<std::int64_t>(options.seed)); // bit pattern of the unsigned seed
+    (*map)["seed"] = seed;
+
+    tensorflow::Feature rng = tensorflow::Feature();
+    tensorflow::BytesList* rng_engine = rng.mutable_bytes_list();
+    rng_engine->add_value(options.rng_engine);
+    (*map)["rng"] = rng;
+
+    tensorflow::Feature replicate_engine = tensorflow::Feature();
+    tensorflow::BytesList* engine_name = replicate_engine.mutable_bytes_list();
+    engine_name->add_value(engine);
+    (*map)["engine"] = replicate_engine;
+
+    tensorflow::Feature sampler = tensorflow::Feature();
+    tensorflow::BytesList* sampler_name = sampler.mutable_bytes_list();
+    sampler_name->add_value(options.sampler);
+    (*map)["sampler"] = sampler;
+
+    // each invasion attempt of a haploid replicate jumps at most once (see absorbing_shortcut)
+    const double shortcut_error_bound = P::number_traits == 1 ?
+      (1 + params.shared.number_reinvasions) * options.shortcut_epsilon : 0.0;
+    tensorflow::Feature shortcut = tensorflow::Feature();
+    tensorflow::FloatList* shortcut_epsilon = shortcut.mutable_float_list();
+    shortcut_epsilon->add_value(options.shortcut_epsilon);
+    (*map)["shortcut_epsilon"] = shortcut;
+
+    tensorflow::Feature shortcut_bound = tensorflow::Feature();
+    tensorflow::FloatList* shortcut_error = shortcut_bound.mutable_float_list();
+    shortcut_error->add_value(shortcut_error_bound);
+    (*map)["shortcut_error_bound"] = shortcut_bound;
+
+    tensorflow::Feature quasi_stationary = tensorflow::Feature();
+    tensorflow::BytesList* quasi_stationary_mode = quasi_stationary.mutable_bytes_list();
+    quasi_stationary_mode->add_value(options.quasi_stationary ? "on" : "off");
+    (*map)["quasi_stationary"] = quasi_stationary;
+
+    tensorflow::Feature traits = tensorflow::Feature();
+    tensorflow::BytesList* traits_recorded = traits.mutable_bytes_list();
+    traits_recorded->add_value(options.traits);
+    (*map)["traits"] = traits;
   }
 
   template<class P>
   void add_parameters_to_protobuf(google::protobuf::Map<std::string, tensorflow::Feature>* map,
-				  P params, char* argv[]){
+				  P params, char* argv[], const std::string &engine){
     add_specific_parameters_to_protobuf(map, params);
-    add_shared_parameters_to_protobuf(map, params, argv);
+    add_shared_parameters_to_protobuf(map, params, argv, engine);
   }
   
 }
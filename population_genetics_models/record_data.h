@@ -1,41 +1,103 @@
 #ifndef RECORD_DATA_H
 #define RECORD_DATA_H
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 #include "include/example.pb.h"
 #include "conditional_existence_status.h"
+#include "trait_freq.h"
 
 namespace record_data {
 
-  void raw_trait_freq(tensorflow::FloatList* raw_trait_freq, const std::vector<double> &trait_freq);
+  template <std::size_t K>
+  void raw_trait_freq(tensorflow::FloatList* raw_trait_freq, const std::array<int, K> &trait_count,
+		      const int population_size){
+    // single value per gen for HSE (P(A); two values per gen for DSE (P(AA) and P(Aa))
+    for (std::size_t i = 0; i < K; i++){
+      raw_trait_freq->add_value(static_cast<double>(trait_count[i]) / population_size);
+    }
+  }
 
   template <class P>
-  void generation_trait_extinction(tensorflow::Int64List* gen_extinct, const std::vector<double> &trait_freq,
+  void generation_trait_extinction(tensorflow::Int64List* gen_extinct, const trait_freq::trait_counts<P> &trait_count,
 				   const P &params, const int gen){
-    if (conditional_existence_status::trait_extinct(trait_freq, params)){
+    if (conditional_existence_status::trait_extinct(trait_count, params)){
       gen_extinct->add_value(gen); // extinct trait, record generation of extinction
-    } else if (!conditional_existence_status::trait_extinct(trait_freq, params)){
-      gen_extinct->add_value(params.fixed.max_generations_per_sim); // trait persists, denote by max gen
     } else {
-      exit(EXIT_FAILURE);
+      gen_extinct->add_value(params.fixed.max_generations_per_sim); // trait persists, denote by max gen
     }
   }
 
   template <class P>
-  void number_reinvasions_before_extinction(tensorflow::Int64List* reinvasion_number, const std::vector<double>
-					    &trait_freq, const P &params, const int reinvasions){
+  void number_reinvasions_before_extinction(tensorflow::Int64List* reinvasion_number,
+					    const trait_freq::trait_counts<P> &trait_count, const P &params,
+					    const int reinvasions){
     // -1 if not looking at reinvasions
     // if the trait is extinct, then the value of `reinvasions` is correct
     // if the trait persists, however, we need to add 1 (otherwise I can't distinguish between traits
     // that go extinct in the final reinvasion and those that survive all attempts)
-    if (conditional_existence_status::trait_extinct(trait_freq, params)){
+    if (conditional_existence_status::trait_extinct(trait_count, params)){
       reinvasion_number->add_value(reinvasions);
-    } else if (!conditional_existence_status::trait_extinct(trait_freq, params)){ 
-      reinvasion_number->add_value(reinvasions + 1);
     } else {
-      exit(EXIT_FAILURE);
+      reinvasion_number->add_value(reinvasions + 1);
+    }
+  }
+
+  /**
+     @brief Records number_reinvasions at each of \p depths, derived from the record at the full depth
+     (params.shared.number_reinvasions)
+     @details The reinvasion attempts of a replicate run at depth k are the first k attempts of the same replicate
+     run at any larger depth, so a value v (see number_reinvasions_before_extinction) at the full depth is min(v, k)
+     at depth k. Writes "number_reinvasions_before_extinction_<k>" (Int64List, from the replicates) and/or
+     "number_reinvasions_probability_<k>" (FloatList, from the exact and pde engines), whichever the full-depth
+     record has, and "reinvasion_depths". With \p suffix (--traits=both) the keys of the full-depth record and of
+     the derived records end in it (before "_<k>").
+  */
+  inline void reinvasion_depths(google::protobuf::Map<std::string, tensorflow::Feature>* feature_map,
+				const std::vector<int> &depths, const std::string &suffix = ""){
+    const auto replicates = feature_map->find("number_reinvasions_before_extinction" + suffix);
+    const auto probabilities = feature_map->find("number_reinvasions_probability" + suffix);
+    tensorflow::Feature recorded_depths = tensorflow::Feature();
+    std::vector<std::pair<std::string, tensorflow::Feature>> derived_features;
+    for (const int depth : depths){
+      recorded_depths.mutable_int64_list()->add_value(depth);
+      if (replicates != feature_map->end()){
+	tensorflow::Feature derived = tensorflow::Feature();
+	tensorflow::Int64List* values = derived.mutable_int64_list();
+	values->mutable_value()->Reserve(replicates->second.int64_list().value_size());
+	for (const std::int64_t value : replicates->second.int64_list().value()){
+	  values->add_value(std::min<std::int64_t>(value, depth));
+	}
+	derived_features.emplace_back("number_reinvasions_before_extinction" + suffix + "_" + std::to_string(depth),
+				      derived);
+      }
+      if (probabilities != feature_map->end()){
+	// element k is P(number_reinvasions == k - 1): depth d keeps elements 0..d and lumps the rest into d + 1
+	const auto &full = probabilities->second.float_list().value();
+	tensorflow::Feature derived = tensorflow::Feature();
+	tensorflow::FloatList* values = derived.mutable_float_list();
+	double survives_all = 0.0;
+	for (int k = 0; k < full.size(); k++){
+	  if (k <= depth){
+	    values->add_value(full[k]);
+	  } else {
+	    survives_all += full[k];
+	  }
+	}
+	values->add_value(survives_all);
+	derived_features.emplace_back("number_reinvasions_probability" + suffix + "_" + std::to_string(depth), derived);
+      }
+    }
+    // inserted after the loop (inserting may invalidate the iterators of the full-depth records)
+    for (auto &[key, feature] : derived_features){
+      (*feature_map)[key] = feature;
     }
+    (*feature_map)["reinvasion_depths"] = recorded_depths;
   }
 
 }
@@ -0,0 +1,258 @@
+/**
+   @file reinvasion_law.h
+   @brief Samples the number of reinvasions a fixed trait resists in closed form (--reinvasions=geometric)
+*/
+#ifndef REINVASION_LAW_H
+#define REINVASION_LAW_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "include/example.pb.h"
+#include "Parameters.h"
+#include "binomial.h"
+#include "conditional_existence_status.h"
+#include "environment_schedule.h"
+#include "markov_chain.h"
+#include "rng.h"
+#include "run_options.h"
+#include "thread_pool.h"
+#include "trait_freq.h"
+#include "trait_invasion.h"
+
+/**
+   @brief Namespace for closed-form reinvasion sampling
+   @details Once allele A is fixed, every reinvasion attempt starts from the same state (the fixed state with
+   invader_count individuals carrying the trait replaced). An attempt that the trait resists by fixing again
+   returns to that state, so the attempts are independent trials with a single probability of resistance rho, and
+   the number of attempts resisted before the trait is lost is geometric. rho is calculated once per parameter set,
+   and only when that is cheaper than simulating the attempts it replaces: first
+   fixed_parameters::reinvasion_gate_replicates replicates (with one attempt after each that fixes) estimate how
+   many attempts the replicates would simulate and how long they take (see simulated_attempts), then rho is
+   calculated
+   - exactly (markov_chain::run_attempt) for the haploid models with N up to
+   fixed_parameters::reinvasion_exact_population_size and a deterministic environment schedule (the chain is
+   solved generation by generation, so it cannot follow the random environments of a Markov schedule), provided
+   that the chain converges within exact_work_budget (near neutrality it takes of order N generations of N times
+   the band width each, far more than simulating the attempts)
+   - otherwise from fixed_parameters::reinvasion_pilot_attempts simulated attempts (on the thread pool, with
+   streams of the root engine that the replicates do not use), provided that the replicates would simulate more
+   attempts than that and that at least fixed_parameters::reinvasion_pilot_min_outcomes of them are resisted and
+   as many are lost. The one estimate drives every replicate, so its error is not averaged out over the
+   replicates; with fewer of either outcome its relative error is above about 10% (and with none it would report
+   no losses, or no resisted attempts, at all), so the reinvasions are simulated instead
+
+   An attempt can also be resisted without fixing (the trait is still segregating at max_generations_per_sim),
+   after which the next attempt starts elsewhere. If that has a probability above
+   Fixed_Parameters::exact_convergence_tolerance (exact) or happens in the pilot, the reinvasions are simulated as
+   before, as they are with --reinvasions=simulate (for validation). Replicates whose initial invasion ends
+   without fixing always simulate their reinvasions until the trait is fixed or lost.
+*/
+namespace reinvasion_law {
+  /**
+     @brief Law of the reinvasion attempts that start from the fixed state
+  */
+  template <class P>
+  struct Law {
+    std::string method; /**< exact, pilot, or simulated (closed-form sampling not used) */
+    double resistance = 0.0; /**< rho = P(the trait fixes again in an attempt) */
+    double standard_error = 0.0; /**< Standard error of rho (0 if exact) */
+    trait_freq::trait_counts<P> fixed_state {}; /**< State in which an attempt that fixes ends */
+
+    bool closed_form() const {
+      return method.compare("simulated") != 0;
+    }
+    /** @brief True if reinvasions from \p trait_count can be sampled in closed form */
+    bool applies(const trait_freq::trait_counts<P> &trait_count) const {
+      return closed_form() && trait_count == fixed_state;
+    }
+    /**
+       @brief Number of consecutive attempts (of at most \p remaining) that the trait resists
+       @return \p remaining if it resists them all (otherwise it is lost in the next attempt)
+    */
+    template <class R>
+    int sample_resisted(R &rng, const int remaining) const {
+      if (resistance >= 1.0){
+	return remaining;
+      }
+      if (resistance <= 0.0){
+	return 0;
+      }
+      const double resisted = std::floor(std::log1p(-binomial::uniform_01(rng)) / std::log(resistance));
+      return resisted >= remaining ? remaining : static_cast<int>(resisted);
+    }
+  };
+  /** @brief State of a population in which allele A is fixed */
+  template <class P>
+  trait_freq::trait_counts<P> fixed_state(const P &params){
+    trait_freq::trait_counts<P> trait_count {};
+    trait_count[0] = params.shared.population_size; // all A (haploid) or all AA (diploid)
+    return trait_count;
+  }
+  /**
+     @brief Number of streams of the root engine used by the replicate chunks and the law (engines that need
+     more streams take them after these)
+  */
+  template <class P>
+  int reserved_streams(const P &params){
+    const int chunk = params.fixed.replicates_per_chunk;
+    return (params.fixed.number_replicates_QEF + chunk - 1) / chunk +
+      (fixed_parameters::reinvasion_pilot_attempts + chunk - 1) / chunk + 1;
+  }
+  /**
+     @brief Number of attempts from the fixed state that the replicates simulate, at most
+     @details number_replicates_QEF * P(fixed) * number_reinvasions, where P(fixed) is estimated as
+     (\p fixed + 1) / (\p invasions + 1) from \p invasions pilot invasions of which \p fixed end with the trait
+     fixed (so that a pilot without a fixation does not rule out long runs of reinvasions)
+  */
+  template <class P>
+  double simulated_attempts(const P &params, const int fixed, const int invasions){
+    return static_cast<double>(params.fixed.number_replicates_QEF) * (fixed + 1.0) / (invasions + 1.0) *
+      params.shared.number_reinvasions;
+  }
+  /** @brief True if estimating rho from the pilot costs less than simulating \p attempts attempts */
+  inline bool pilot_pays(const double attempts){
+    return attempts > fixed_parameters::reinvasion_pilot_attempts;
+  }
+  /**
+     @brief Multiply-adds that the exact calculation of rho may take before it is abandoned
+     @details As many as simulating the \p attempts attempts of \p attempt_generations generations each that it
+     replaces costs, at fixed_parameters::reinvasion_exact_work_per_generation multiply-adds per generation (the
+     pilot is not a cheaper alternative when most attempts are resisted, as it then sees too few losses)
+  */
+  inline double exact_work_budget(const double attempts, const double attempt_generations){
+    return attempts * attempt_generations * fixed_parameters::reinvasion_exact_work_per_generation;
+  }
+  /**
+     @brief Estimates rho from simulated attempts
+     @param[in] streams The reserved streams of the root engine (the pilot uses those after the replicate chunks)
+  */
+  template <class K, class R>
+  Law<typename K::Parameters> pilot(const K &kernel, const typename K::Parameters &params,
+				    const invasion::Shortcuts<K> &shortcuts, std::vector<R> &streams,
+				    trait_freq::trait_counts<typename K::Parameters> start, Law<typename K::Parameters> law){
+    const int attempts = fixed_parameters::reinvasion_pilot_attempts;
+    const int chunks = (attempts + params.fixed.replicates_per_chunk - 1) / params.fixed.replicates_per_chunk;
+    // the replicate chunks use the first streams of rng (see conditional_existence_probability)
+    const int replicate_chunks = reserved_streams(params) - chunks - 1;
+    std::vector<int> chunk_resisted(chunks, 0), chunk_elsewhere(chunks, 0);
+    thread_pool::get_pool().parallel_for(chunks, [&](int chunk){
+      R &chunk_rng = streams[replicate_chunks + chunk];
+      const int first = chunk * params.fixed.replicates_per_chunk;
+      const int last = std::min(first + params.fixed.replicates_per_chunk, attempts);
+      for (int i = first; i < last; i++){
+	trait_freq::trait_counts<typename K::Parameters> trait_count = start;
+	int gen = -1;
+	invasion::trait_invasion(kernel, params, shortcuts, chunk_rng, trait_count, gen);
+	if (trait_count == law.fixed_state){
+	  chunk_resisted[chunk]++;
+	} else if (!conditional_existence_status::trait_extinct(trait_count, params)){
+	  chunk_elsewhere[chunk]++;
+	}
+      }
+    });
+    int resisted = 0, elsewhere = 0;
+    for (int chunk = 0; chunk < chunks; chunk++){
+      resisted += chunk_resisted[chunk];
+      elsewhere += chunk_elsewhere[chunk];
+    }
+    const int lost = attempts - resisted - elsewhere;
+    if (elsewhere > 0 || resisted < fixed_parameters::reinvasion_pilot_min_outcomes ||
+	lost < fixed_parameters::reinvasion_pilot_min_outcomes){
+      return law;
+    }
+    law.method = "pilot";
+    law.resistance = static_cast<double>(resisted) / attempts;
+    law.standard_error = std::sqrt(law.resistance * (1.0 - law.resistance) / attempts);
+    return law;
+  }
+  /**
+     @brief Calculates the law of the reinvasion attempts for the parameters of \p kernel
+     @return A law whose method is "simulated" if the reinvasions are to be simulated
+  */
+  template <class K, class R>
+  Law<typename K::Parameters> calculate(const K &kernel, const typename K::Parameters &params, const R &rng){
+    using P = typename K::Parameters;
+    Law<P> law;
+    law.method = "simulated";
+    law.fixed_state = fixed_state(params);
+    trait_freq::trait_counts<P> start = law.fixed_state;
+    start[params.shared.trait_info[0]] -= trait_freq::invader_count(params);
+    if (run_options::get().reinvasions.compare("geometric") != 0 || params.shared.number_reinvasions <= 0 ||
+	conditional_existence_status::trait_extinct(law.fixed_state, params)){
+      return law;
+    }
+    // the replicate chunks and the pilot use the first streams of rng, and the last reserved one is for the gate
+    std::vector<R> streams = rng::make_streams(rng, reserved_streams(params));
+    R &gate_rng = streams.back();
+    const invasion::Shortcuts<K> shortcuts(kernel, params);
+    // replicates of the point, with one attempt after each that fixes (which is what the replicates simulate)
+    int fixed = 0;
+    double generations = 0.0;
+    for (int i = 0; i < fixed_parameters::reinvasion_gate_replicates; i++){
+      trait_freq::trait_counts<P> trait_count = trait_freq::initialise_trait_counts(params);
+      int gen = -1;
+      invasion::trait_invasion(kernel, params, shortcuts, gate_rng, trait_count, gen);
+      if (trait_count == law.fixed_state){
+	fixed++;
+	trait_count = start;
+	gen = -1;
+	invasion::trait_invasion(kernel, params, shortcuts, gate_rng, trait_count, gen);
+	generations += gen + 1;
+      }
+    }
+    const double attempt_generations = fixed > 0 ? generations / fixed : 1.0;
+    const double attempts = simulated_attempts(params, fixed, fixed_parameters::reinvasion_gate_replicates);
+    if constexpr (markov_chain::has_exact_solver<K>::value){
+      const int N = params.shared.population_size;
+      if (N <= fixed_parameters::reinvasion_exact_population_size && environment_schedule::deterministic(kernel)){
+	std::vector<markov_chain::Transition_Matrix> matrices;
+	std::vector<bool> built;
+	std::vector<double> start_distribution(N + 1, 0.0);
+	start_distribution[std::clamp(start[0], 0, N)] = 1.0;
+	const double budget = exact_work_budget(attempts, attempt_generations);
+	const markov_chain::Attempt attempt = markov_chain::run_attempt(kernel, params, start_distribution, matrices,
+									 built, budget);
+	if (attempt.complete){
+	  double elsewhere = 0.0;
+	  for (int j = 1; j < N; j++){
+	    elsewhere += attempt.persisting[j];
+	  }
+	  if (elsewhere > params.fixed.exact_convergence_tolerance){
+	    return law;
+	  }
+	  law.method = "exact";
+	  law.resistance = attempt.persisting[N] / (attempt.persisting[N] + attempt.extinct);
+	  return law;
+	}
+      }
+    }
+    if (!pilot_pays(attempts)){
+      return law;
+    }
+    return pilot(kernel, params, shortcuts, streams, start, law);
+  }
+  /**
+     @brief Records the law ("reinvasion_law", and "reinvasion_resistance_probability" and
+     "reinvasion_resistance_standard_error" if it is sampled in closed form), with keys ending in \p suffix
+  */
+  template <class P>
+  void record(const Law<P> &law, google::protobuf::Map<std::string, tensorflow::Feature>* feature_map,
+	      const std::string &suffix = ""){
+    tensorflow::Feature method = tensorflow::Feature();
+    method.mutable_bytes_list()->add_value(law.method);
+    (*feature_map)["reinvasion_law" + suffix] = method;
+    if (law.closed_form()){
+      tensorflow::Feature resistance = tensorflow::Feature();
+      resistance.mutable_float_list()->add_value(law.resistance);
+      tensorflow::Feature standard_error = tensorflow::Feature();
+      standard_error.mutable_float_list()->add_value(law.standard_error);
+      (*feature_map)["reinvasion_resistance_probability" + suffix] = resistance;
+      (*feature_map)["reinvasion_resistance_standard_error" + suffix] = standard_error;
+    }
+  }
+
+}
+
+#endif
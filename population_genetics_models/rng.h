@@ -1,16 +1,205 @@
 /**
    @file rng.h
-   @brief Provides \p initialise_rng
+   @brief Random number engines and the functions to seed and split them
 */
 
 #ifndef RNG_H
 #define RNG_H
 
+#include <array>
+#include <cstdint>
+#include <limits>
 #include <random>
+#include <string>
+#include <vector>
 
+/**
+   @brief Namespace for random number generation
+   @details All engines satisfy UniformRandomBitGenerator (so they work with the \p std:: distributions) and share
+   a small interface:
+   - a constructor taking a 64-bit seed (so a run is reproducible from the seed alone)
+   - \p jump(), which moves the engine to the start of the next independent stream
+
+   Code that needs one generator per task (e.g. per chunk of replicates) calls make_streams(), which returns
+   streams that depend only on the seed and the stream index.
+*/
 namespace rng {
-  
-  std::mt19937 initialise_rng();
- 
+  /**
+     @brief splitmix64 step (used to expand a 64-bit seed into engine state)
+  */
+  inline std::uint64_t splitmix64(std::uint64_t &state){
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+  /**
+     @brief xoshiro256++ (Blackman & Vigna), a fast 64-bit engine with 2^256 - 1 period
+     @details \p jump() advances the engine by 2^128 draws, so successive jumps give non-overlapping streams.
+  */
+  class Xoshiro256pp {
+  public:
+    using result_type = std::uint64_t;
+    static constexpr const char* name = "xoshiro256pp";
+
+    explicit Xoshiro256pp(std::uint64_t seed){
+      for (std::uint64_t &word : state){
+	word = splitmix64(seed);
+      }
+    }
+    static constexpr result_type min(){ return 0; }
+    static constexpr result_type max(){ return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()(){
+      const std::uint64_t result = rotl(state[0] + state[3], 23) + state[0];
+      const std::uint64_t t = state[1] << 17;
+      state[2] ^= state[0];
+      state[3] ^= state[1];
+      state[1] ^= state[2];
+      state[0] ^= state[3];
+      state[2] ^= t;
+      state[3] = rotl(state[3], 45);
+      return result;
+    }
+
+    void jump(){
+      static constexpr std::uint64_t jump_polynomial[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+							  0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+      std::array<std::uint64_t, 4> jumped {0, 0, 0, 0};
+      for (std::uint64_t word : jump_polynomial){
+	for (int bit = 0; bit < 64; bit++){
+	  if (word & (std::uint64_t{1} << bit)){
+	    for (int i = 0; i < 4; i++){
+	      jumped[i] ^= state[i];
+	    }
+	  }
+	  (*this)();
+	}
+      }
+      state = jumped;
+    }
+
+  private:
+    static std::uint64_t rotl(const std::uint64_t x, const int k){
+      return (x << k) | (x >> (64 - k));
+    }
+    std::array<std::uint64_t, 4> state;
+  };
+  /**
+     @brief Philox4x32-10 (Salmon et al. 2011), a counter-based engine
+     @details Output is a bijection of (key, counter), so streams are O(1) to create: the seed is the key and
+     the stream index occupies the upper half of the counter. \p jump() moves to the next stream index.
+  */
+  class Philox4x32 {
+  public:
+    using result_type = std::uint64_t;
+    static constexpr const char* name = "philox4x32";
+
+    explicit Philox4x32(std::uint64_t seed)
+      : key {static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)} {}
+    static constexpr result_type min(){ return 0; }
+    static constexpr result_type max(){ return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()(){
+      if (output_index == 2){
+	generate_block();
+      }
+      const std::uint64_t result = (static_cast<std::uint64_t>(output[2 * output_index]) << 32) |
+	output[2 * output_index + 1];
+      output_index++;
+      return result;
+    }
+
+    void jump(){
+      block = 0;
+      stream++;
+      output_index = 2;
+    }
+
+  private:
+    void generate_block(){
+      std::array<std::uint32_t, 4> counter {static_cast<std::uint32_t>(block), static_cast<std::uint32_t>(block >> 32),
+	static_cast<std::uint32_t>(stream), static_cast<std::uint32_t>(stream >> 32)};
+      std::array<std::uint32_t, 2> round_key = key;
+      for (int round = 0; round < 10; round++){
+	const std::uint64_t product_0 = static_cast<std::uint64_t>(0xD2511F53U) * counter[0];
+	const std::uint64_t product_1 = static_cast<std::uint64_t>(0xCD9E8D57U) * counter[2];
+	counter = {static_cast<std::uint32_t>(product_1 >> 32) ^ counter[1] ^ round_key[0],
+		   static_cast<std::uint32_t>(product_1),
+		   static_cast<std::uint32_t>(product_0 >> 32) ^ counter[3] ^ round_key[1],
+		   static_cast<std::uint32_t>(product_0)};
+	round_key[0] += 0x9E3779B9U;
+	round_key[1] += 0xBB67AE85U;
+      }
+      output = counter;
+      block++;
+      output_index = 0;
+    }
+    std::array<std::uint32_t, 2> key;
+    std::uint64_t stream = 0;
+    std::uint64_t block = 0;
+    std::array<std::uint32_t, 4> output {0, 0, 0, 0};
+    int output_index = 2;
+  };
+  /**
+     @brief The Mersenne Twister used by earlier versions, seeded from (seed, stream index) via \p std::seed_seq
+  */
+  class Mt19937 : public std::mt19937 {
+  public:
+    static constexpr const char* name = "mt19937";
+
+    explicit Mt19937(std::uint64_t seed) : std::mt19937(), seed(seed) {
+      reseed();
+    }
+
+    void jump(){
+      stream++;
+      reseed();
+    }
+
+  private:
+    void reseed(){
+      std::seed_seq seq {static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32),
+	static_cast<std::uint32_t>(stream)};
+      std::mt19937::seed(seq);
+    }
+    std::uint64_t seed;
+    std::uint32_t stream = 0;
+  };
+  /**
+     @brief Returns \p number_streams independent engines, stream i being \p root jumped i + 1 times
+  */
+  template <class R>
+  std::vector<R> make_streams(const R &root, const int number_streams){
+    std::vector<R> streams;
+    streams.reserve(number_streams);
+    R stream = root;
+    for (int i = 0; i < number_streams; i++){
+      stream.jump();
+      streams.push_back(stream);
+    }
+    return streams;
+  }
+  /**
+     @brief Generates a seed from \p std::random_device and \p std::chrono::high_resolution_clock (used when no --seed is given)
+  */
+  std::uint64_t random_seed();
+  /**
+     @brief Constructs the engine named \p engine_name (xoshiro256pp if unrecognised), seeded with \p seed, and calls f(engine)
+  */
+  template <class F>
+  void with_engine(const std::string &engine_name, const std::uint64_t seed, F f){
+    if (engine_name.compare(Philox4x32::name) == 0){
+      Philox4x32 engine(seed);
+      f(engine);
+    } else if (engine_name.compare(Mt19937::name) == 0){
+      Mt19937 engine(seed);
+      f(engine);
+    } else {
+      Xoshiro256pp engine(seed);
+      f(engine);
+    }
+  }
+
 }
-#endif 
+#endif
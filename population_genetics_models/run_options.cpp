@@ -0,0 +1,111 @@
+#include <cassert>
+#include <string>
+#include <thread>
+#include <vector>
+#include "run_options.h"
+#include "rng.h"
+
+namespace run_options {
+
+  namespace {
+    Run_Options options {static_cast<int>(std::thread::hardware_concurrency()) > 0 ?
+	static_cast<int>(std::thread::hardware_concurrency()) : 1, 0, rng::Xoshiro256pp::name, "batched", "binomial", 0.0, "geometric", {}, false, "one", {}, "switch", "", 0.0, 0.0};
+    /** Options of the parameter point running on this thread, if set_seed gave it its own seed */
+    thread_local Run_Options point_options;
+    thread_local bool has_point_options = false;
+  }
+
+  int parse_run_options(int argc, char* argv[]){
+    int positional_argc = 0;
+    bool seed_given = false;
+    for (int i = 0; i < argc; i++){
+      const std::string arg(argv[i]);
+      if (arg.rfind("--", 0) != 0){
+	argv[positional_argc++] = argv[i]; // positional argument, keep
+	continue;
+      }
+      const std::size_t equals = arg.find('=');
+      assert(equals != std::string::npos && "Run options must be of the form --key=value");
+      const std::string key = arg.substr(2, equals - 2);
+      const std::string value = arg.substr(equals + 1);
+      if (key.compare("threads") == 0){
+	options.number_threads = std::stoi(value);
+	assert(options.number_threads > 0 && "--threads must be positive");
+      } else if (key.compare("seed") == 0){
+	options.seed = std::stoull(value);
+	seed_given = true;
+      } else if (key.compare("rng") == 0){
+	assert((value.compare(rng::Xoshiro256pp::name) == 0 || value.compare(rng::Philox4x32::name) == 0 ||
+		value.compare(rng::Mt19937::name) == 0) && "--rng must be xoshiro256pp, philox4x32 or mt19937");
+	options.rng_engine = value;
+      } else if (key.compare("engine") == 0){
+	assert((value.compare("batched") == 0 || value.compare("scalar") == 0 || value.compare("ensemble") == 0 ||
+		value.compare("exact") == 0 || value.compare("diffusion") == 0 || value.compare("pde") == 0 ||
+		value.compare("branching") == 0 || value.compare("splitting") == 0) &&
+	       "--engine must be batched, scalar, ensemble, exact, diffusion, pde, branching or splitting");
+	options.engine = value;
+      } else if (key.compare("sampler") == 0){
+	assert((value.compare("binomial") == 0 || value.compare("alias") == 0) && "--sampler must be binomial or alias");
+	options.sampler = value;
+      } else if (key.compare("shortcut") == 0){
+	options.shortcut_epsilon = std::stod(value);
+	assert(options.shortcut_epsilon >= 0.0 && options.shortcut_epsilon < 1.0 && "--shortcut must be in [0, 1)");
+      } else if (key.compare("reinvasions") == 0){
+	assert((value.compare("geometric") == 0 || value.compare("simulate") == 0) &&
+	       "--reinvasions must be geometric or simulate");
+	options.reinvasions = value;
+      } else if (key.compare("reinvasion_depths") == 0){
+	options.reinvasion_depths.clear();
+	for (std::size_t begin = 0; begin < value.size();){
+	  const std::size_t comma = std::min(value.find(',', begin), value.size());
+	  options.reinvasion_depths.push_back(std::stoi(value.substr(begin, comma - begin)));
+	  assert(options.reinvasion_depths.back() >= 0 && "--reinvasion_depths must be non-negative");
+	  begin = comma + 1;
+	}
+      } else if (key.compare("switch_generations") == 0){
+	options.switch_generations.clear();
+	for (std::size_t begin = 0; begin < value.size();){
+	  const std::size_t comma = std::min(value.find(',', begin), value.size());
+	  options.switch_generations.push_back(std::stoi(value.substr(begin, comma - begin)));
+	  begin = comma + 1;
+	}
+      } else if (key.compare("environment_schedule") == 0){
+	options.environment_schedule = value; // parsed by environment_schedule::Schedule
+      } else if (key.compare("manifest") == 0){
+	options.manifest = value;
+      } else if (key.compare("precision") == 0){
+	options.precision = std::stod(value);
+	assert(options.precision >= 0.0 && "--precision must be non-negative");
+      } else if (key.compare("relative_precision") == 0){
+	options.relative_precision = std::stod(value);
+	assert(options.relative_precision >= 0.0 && "--relative_precision must be non-negative");
+      } else if (key.compare("traits") == 0){
+	assert((value.compare("one") == 0 || value.compare("both") == 0) && "--traits must be one or both");
+	options.traits = value;
+      } else if (key.compare("quasi_stationary") == 0){
+	assert((value.compare("on") == 0 || value.compare("off") == 0) && "--quasi_stationary must be on or off");
+	options.quasi_stationary = value.compare("on") == 0;
+      } else {
+	assert(false && "Unknown run option (valid options: --threads, --seed, --rng, --engine, --sampler, --shortcut, "
+	       "--reinvasions, --reinvasion_depths, --quasi_stationary, --traits, --switch_generations, "
+	       "--environment_schedule, --manifest, --precision, --relative_precision)");
+      }
+    }
+    if (!seed_given){
+      options.seed = rng::random_seed(); // fixed for the rest of the run and recorded in the output
+    }
+    argv[positional_argc] = nullptr;
+    return positional_argc;
+  }
+
+  const Run_Options& get(){
+    return has_point_options ? point_options : options;
+  }
+
+  void set_seed(std::uint64_t seed){
+    point_options = options;
+    point_options.seed = seed;
+    has_point_options = true;
+  }
+
+}
@@ -0,0 +1,76 @@
+/**
+   @file run_options.h
+   @brief Options (of the form --key=value) that control how a simulation is run rather than what is simulated
+*/
+#ifndef RUN_OPTIONS_H
+#define RUN_OPTIONS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+   @brief Namespace for run options
+   @details Run options are given on the command line as --key=value and may appear anywhere after the
+   program name. They are removed from argv before the positional model arguments are parsed, so they do
+   not change the output file name.
+*/
+namespace run_options {
+  /**
+     @brief Struct containing the run options
+  */
+  struct Run_Options {
+    int number_threads; /**< Number of threads used to run replicates (defaults to the number of cores) */
+    std::uint64_t seed; /**< Seed for the random number engine (random if --seed is not given) */
+    std::string rng_engine; /**< Name of the random number engine (xoshiro256pp, philox4x32 or mt19937) */
+    /** Replicate engine: batched (default), scalar, ensemble, exact, diffusion, pde, branching or splitting (all
+	but scalar are for QEF runs only; see run_scenario::QEF) */
+    std::string engine;
+    std::string sampler; /**< Transition sampler of the per-replicate engine: binomial (default) or alias (see alias_table) */
+    double shortcut_epsilon; /**< Loss probability below which a haploid replicate jumps to fixation (0, the default,
+				disables it; see absorbing_shortcut) */
+    /** Reinvasion attempts from the fixed state: geometric (default, sampled in closed form; see reinvasion_law) or
+	simulate */
+    std::string reinvasions;
+    /** Reinvasion depths (each at most number_reinvasions) for which number_reinvasions is also recorded
+	(--reinvasion_depths=k1,k2,...; see record_data::reinvasion_depths) */
+    std::vector<int> reinvasion_depths;
+    bool quasi_stationary; /**< Resolve attempts that settle at a stable polymorphism (--quasi_stationary=on; see quasi_stationary) */
+    /** DSE traits of interest: one (default, the trait given by the model arguments) or both (AA and Aa from one
+	pass; see genotype_coupling) */
+    std::string traits;
+    /** HTE generations of the switch to environment 2 to sweep in one run (--switch_generations=g1,g2,...; see
+	environment_fork). Empty (the default) runs the gen_env_1 given by the model arguments */
+    std::vector<int> switch_generations;
+    /** HTE environment schedule: switch (default, gen_env_1 of the model arguments), piecewise:..., periodic:... or
+	markov:... (see environment_schedule) */
+    std::string environment_schedule;
+    /** Path of a sweep manifest: run every parameter point it lists in this process (see manifest). Empty (the
+	default) runs the point given on the command line */
+    std::string manifest;
+    /** Half-width of the 95% Wilson intervals of the persistence probabilities at which the QEF replicates stop
+	(--precision=h; see sequential_stopping). 0 (the default) runs all number_replicates_QEF replicates */
+    double precision;
+    /** As precision, relative to the estimated probability (--relative_precision=r) */
+    double relative_precision;
+  };
+  /**
+     @brief Parses run options and removes them from argv
+     @param[in] argc Number of command line arguments
+     @param[in, out] argv Command line arguments (run options are removed)
+     @return Number of remaining (positional) command line arguments
+  */
+  int parse_run_options(int argc, char* argv[]);
+  /**
+     @brief Returns the run options (set by parse_run_options)
+  */
+  const Run_Options& get();
+  /**
+     @brief Replaces the seed of the run options on the calling thread (the sweep mode gives each parameter point
+     its own seed; points run concurrently on different threads, and only the thread running a point reads its seed)
+  */
+  void set_seed(std::uint64_t seed);
+
+}
+
+#endif
@@ -1,42 +1,215 @@
 #ifndef RUN_SCENARIO_H
 #define RUN_SCENARIO_H
 
+#include <algorithm>
+#include <cassert>
 #include <string>
 #include <vector>
 #include "include/example.pb.h"
+#include "backward_equation.h"
+#include "batched_invasion.h"
+#include "branching_process.h"
 #include "conditional_existence_probability.h"
+#include "diffusion.h"
+#include "environment_fork.h"
+#include "genotype_coupling.h"
+#include "markov_chain.h"
+#include "multilevel_splitting.h"
+#include "run_options.h"
 #include "record_context.h"
+#include "record_data.h"
+#include "reinvasion_law.h"
+#include "sequential_stopping.h"
 #include "serialize_data.h"
 
 namespace run_scenario {
 
-  template <class P, class F>
-  void QEF(const P &params, std::mt19937 &rng, const std::vector<double> &fitnesses,
-	   F calculate_trait_freqs, char* argv[], int argc){
+  /**
+     @brief Runs the QEF replicates of both DSE traits in one pass (--traits=both; see genotype_coupling)
+     @details Writes the replicate features of each trait (and its reinvasion law) with keys ending in _AA or _Aa,
+     whichever trait the model arguments give.
+  */
+  template <class K, class R>
+  void QEF_both_traits(const K &kernel, const typename K::Parameters &params, R &rng,
+		       google::protobuf::Map<std::string, tensorflow::Feature>* feature_map){
+    using P = typename K::Parameters;
+    const P params_AA {{params.shared.population_size, params.shared.initial_trait_freq,
+	params.shared.number_reinvasions, {0, params.shared.trait_info[1]}}, params.model, params.fixed};
+    const P params_Aa {{params.shared.population_size, params.shared.initial_trait_freq,
+	params.shared.number_reinvasions, {1, params.shared.trait_info[1]}}, params.model, params.fixed};
+    const reinvasion_law::Law<P> law_AA = reinvasion_law::calculate(kernel, params_AA, rng);
+    const reinvasion_law::Law<P> law_Aa = reinvasion_law::calculate(kernel, params_Aa, rng);
+    tensorflow::Feature gen_extinct_AA = tensorflow::Feature();
+    tensorflow::Feature reinvasion_number_AA = tensorflow::Feature();
+    tensorflow::Feature gen_extinct_Aa = tensorflow::Feature();
+    tensorflow::Feature reinvasion_number_Aa = tensorflow::Feature();
+    conditional_existence_probability::calculate_both_traits(kernel, params_AA, params_Aa, rng, law_AA, law_Aa,
+							     gen_extinct_AA.mutable_int64_list(),
+							     reinvasion_number_AA.mutable_int64_list(),
+							     gen_extinct_Aa.mutable_int64_list(),
+							     reinvasion_number_Aa.mutable_int64_list());
+    (*feature_map)["generation_of_extinction_AA"] = gen_extinct_AA;
+    (*feature_map)["number_reinvasions_before_extinction_AA"] = reinvasion_number_AA;
+    (*feature_map)["generation_of_extinction_Aa"] = gen_extinct_Aa;
+    (*feature_map)["number_reinvasions_before_extinction_Aa"] = reinvasion_number_Aa;
+    reinvasion_law::record(law_AA, feature_map, "_AA");
+    reinvasion_law::record(law_Aa, feature_map, "_Aa");
+  }
 
+  /**
+     @brief Runs the QEF replicates of an HTE sweep over the switch generation (--switch_generations; see
+     environment_fork)
+     @details The replicates are run one at a time and recorded as the "scalar" engine, so --engine must be scalar
+     or batched (the default) and --sampler binomial. Writes the replicate features of each switch generation g
+     (and its reinvasion law) with keys ending in _gen_env_1_<g>, and the switch generations as
+     "switch_generations".
+     @param[in] kernels Kernel of each switch generation (in increasing order of \p switch_generations)
+     @param[in] sweep_params Parameters of each switch generation
+     @param[in] params Parameters given by the model arguments (recorded as the context; their gen_env_1 is not run)
+  */
+  template <class K, class R>
+  void QEF_switch_sweep(const std::vector<K> &kernels, const std::vector<typename K::Parameters> &sweep_params,
+			const std::vector<int> &switch_generations, const typename K::Parameters &params, R &rng,
+			char* argv[], int argc){
+    using P = typename K::Parameters;
+    assert(!sequential_stopping::adaptive() && "--precision is not available with --switch_generations");
+    assert((run_options::get().engine.compare("scalar") == 0 || run_options::get().engine.compare("batched") == 0) &&
+	   run_options::get().sampler.compare("binomial") == 0 &&
+	   "--switch_generations needs --engine=scalar or batched and --sampler=binomial");
     tensorflow::Example example = tensorflow::Example();
     tensorflow::Features* features = example.mutable_features();
     google::protobuf::Map<std::string, tensorflow::Feature>* feature_map = features->mutable_feature();
 
-    std::string key_gen = "generation_of_extinction";
-    tensorflow::Feature generation_of_extinction = tensorflow::Feature();
-    tensorflow::Int64List* gen_extinct = generation_of_extinction.mutable_int64_list();
-    std::string key_reinvasion = "number_reinvasions";
-    tensorflow::Feature number_reinvasions = tensorflow::Feature();
-    tensorflow::Int64List* reinvasion_number = number_reinvasions.mutable_int64_list();
+    const int branches = static_cast<int>(kernels.size());
+    std::vector<reinvasion_law::Law<P>> laws;
+    for (int branch = 0; branch < branches; branch++){
+      laws.push_back(reinvasion_law::calculate(kernels[branch], sweep_params[branch], rng));
+    }
+    std::vector<tensorflow::Feature> generation_of_extinction(branches), number_reinvasions(branches);
+    std::vector<tensorflow::Int64List*> gen_extinct, reinvasion_number;
+    for (int branch = 0; branch < branches; branch++){
+      gen_extinct.push_back(generation_of_extinction[branch].mutable_int64_list());
+      reinvasion_number.push_back(number_reinvasions[branch].mutable_int64_list());
+    }
+    environment_fork::calculate(kernels, sweep_params, switch_generations, rng, laws, gen_extinct, reinvasion_number);
 
-    conditional_existence_probability::calculate(params, rng, fitnesses, calculate_trait_freqs,
-						 gen_extinct, reinvasion_number);
-    
-    (*feature_map)[key_gen] = generation_of_extinction;
-    (*feature_map)[key_reinvasion] = number_reinvasions;
-    record_context::add_parameters_to_protobuf(feature_map, params, argv); // metadata, parameter values, etc.
+    const std::vector<int> &depths = run_options::get().reinvasion_depths;
+    assert((depths.empty() || *std::max_element(depths.begin(), depths.end()) <= params.shared.number_reinvasions) &&
+	   "--reinvasion_depths must not exceed number_reinvasions");
+    tensorflow::Feature switches = tensorflow::Feature();
+    for (int branch = 0; branch < branches; branch++){
+      const std::string suffix = "_gen_env_1_" + std::to_string(switch_generations[branch]);
+      (*feature_map)["generation_of_extinction" + suffix] = generation_of_extinction[branch];
+      (*feature_map)["number_reinvasions_before_extinction" + suffix] = number_reinvasions[branch];
+      reinvasion_law::record(laws[branch], feature_map, suffix);
+      if (!depths.empty()){
+	record_data::reinvasion_depths(feature_map, depths, suffix);
+      }
+      switches.mutable_int64_list()->add_value(switch_generations[branch]);
+    }
+    (*feature_map)["switch_generations"] = switches;
+    record_context::add_parameters_to_protobuf(feature_map, params, argv, "scalar"); // metadata, parameter values, etc.
+    serialize::data(example, argc, argv);
+  }
+
+  template <class K, class R>
+  void QEF(const K &kernel, const typename K::Parameters &params, R &rng, char* argv[], int argc){
+    assert(run_options::get().switch_generations.empty() && "--switch_generations is only available for the HTE model");
+    assert((!sequential_stopping::adaptive() || (run_options::get().traits.compare("one") == 0 &&
+						  run_options::get().engine.compare("exact") != 0 &&
+						  run_options::get().engine.compare("pde") != 0 &&
+						  run_options::get().engine.compare("diffusion") != 0 &&
+						  run_options::get().engine.compare("splitting") != 0)) &&
+	   "--precision is only available for the replicate engines (and --traits=one)");
+    assert((run_options::get().traits.compare("one") == 0 || (run_options::get().engine.compare("exact") != 0 &&
+							      run_options::get().engine.compare("pde") != 0 &&
+							      run_options::get().engine.compare("diffusion") != 0 &&
+							      run_options::get().engine.compare("splitting") != 0)) &&
+	   "--traits=both is only available for the replicate engines (use --traits=one with --engine=exact, pde, "
+	   "diffusion or splitting)");
+    if constexpr (!batched_invasion::has_batched_kernel<K>::value){
+      assert(run_options::get().engine.compare("ensemble") != 0 &&
+	     "--engine=ensemble is only available for the haploid models (HSE, HTE, HTEOE)");
+    }
+    if constexpr (!branching_process::has_early_phase<K>::value){
+      assert(run_options::get().engine.compare("branching") != 0 &&
+	     "--engine=branching is only available for the haploid models (HSE, HTE, HTEOE)");
+    }
+
+    tensorflow::Example example = tensorflow::Example();
+    tensorflow::Features* features = example.mutable_features();
+    google::protobuf::Map<std::string, tensorflow::Feature>* feature_map = features->mutable_feature();
+
+    std::string engine = run_options::get().engine; // the engine that runs (see calculate)
+    if (run_options::get().engine.compare("exact") == 0){
+      // distributions calculated from the Markov chain instead of replicates
+      if constexpr (markov_chain::has_exact_solver<K>::value){
+	markov_chain::calculate(kernel, params, feature_map);
+      } else {
+	assert(false && "--engine=exact is only available for the haploid models (HSE, HTE, HTEOE)");
+      }
+    } else if (run_options::get().engine.compare("pde") == 0){
+      // distributions calculated from the diffusion PDE (all models)
+      backward_equation::calculate(kernel, params, feature_map);
+    } else if (run_options::get().traits.compare("both") == 0){
+      // replicates of both DSE traits from one pass
+      if constexpr (genotype_coupling::has_coupling<K>::value){
+	QEF_both_traits(kernel, params, rng, feature_map);
+	engine = "scalar";
+      } else {
+	assert(false && "--traits=both is only available for the DSE model");
+      }
+    } else {
+      std::string key_gen = "generation_of_extinction";
+      tensorflow::Feature generation_of_extinction = tensorflow::Feature();
+      tensorflow::Int64List* gen_extinct = generation_of_extinction.mutable_int64_list();
+      // (not "number_reinvasions", which record_context uses for the parameter)
+      std::string key_reinvasion = "number_reinvasions_before_extinction";
+      tensorflow::Feature number_reinvasions = tensorflow::Feature();
+      tensorflow::Int64List* reinvasion_number = number_reinvasions.mutable_int64_list();
+
+      if (run_options::get().engine.compare("diffusion") == 0){
+	// replicates are quantiles of the diffusion approximation (plus an error estimate against the exact chain)
+	if constexpr (diffusion::has_diffusion_approximation<K>::value){
+	  diffusion::calculate(kernel, params, gen_extinct, reinvasion_number);
+	  diffusion::record_error_estimate(kernel, params, feature_map);
+	} else {
+	  assert(false && "--engine=diffusion is only available for the single-environment haploid models (HSE, HTEOE)");
+	}
+      } else if (run_options::get().engine.compare("splitting") == 0){
+	// weighted leaves of a multilevel splitting run instead of replicates (rare persistence)
+	multilevel_splitting::calculate(kernel, params, rng, gen_extinct, reinvasion_number, feature_map);
+      } else {
+	// reinvasion attempts from the fixed state are sampled in closed form unless --reinvasions=simulate
+	const reinvasion_law::Law<typename K::Parameters> law = reinvasion_law::calculate(kernel, params, rng);
+	engine = conditional_existence_probability::calculate(kernel, params, rng, law, gen_extinct, reinvasion_number);
+	reinvasion_law::record(law, feature_map);
+	if (sequential_stopping::adaptive()){
+	  sequential_stopping::record(feature_map, *gen_extinct, *reinvasion_number, params);
+	}
+      }
+
+      (*feature_map)[key_gen] = generation_of_extinction;
+      (*feature_map)[key_reinvasion] = number_reinvasions;
+    }
+    const std::vector<int> &depths = run_options::get().reinvasion_depths;
+    if (!depths.empty()){
+      assert(*std::max_element(depths.begin(), depths.end()) <= params.shared.number_reinvasions &&
+	     "--reinvasion_depths must not exceed number_reinvasions");
+      if (run_options::get().traits.compare("both") == 0){
+	record_data::reinvasion_depths(feature_map, depths, "_AA");
+	record_data::reinvasion_depths(feature_map, depths, "_Aa");
+      } else {
+	record_data::reinvasion_depths(feature_map, depths);
+      }
+    }
+    record_context::add_parameters_to_protobuf(feature_map, params, argv, engine); // metadata, parameter values, etc.
     serialize::data(example, argc, argv);
   }
 
-  template <class P, class F>
-  void LSTM(const P &params, std::mt19937 &rng, const std::vector<double> &fitnesses,
-	    F calculate_trait_freqs, char* argv[], int argc){
+  template <class K, class R>
+  void LSTM(const K &kernel, const typename K::Parameters &params, R &rng, char* argv[], int argc){
+    assert(!sequential_stopping::adaptive() && "--precision is only available for QEF runs");
     tensorflow::SequenceExample seq_example = tensorflow::SequenceExample();
     // generation of extinction
     tensorflow::Features* features = seq_example.mutable_context();
@@ -54,12 +227,12 @@ namespace run_scenario {
     std::string key_freq = "raw_trait_frequencies";
     tensorflow::FeatureList featurelist = tensorflow::FeatureList();
 
-    conditional_existence_probability::calculate(params, rng, fitnesses, calculate_trait_freqs,
-						 gen_extinct, featurelist);
+    const std::string engine = conditional_existence_probability::calculate(kernel, params, rng, gen_extinct,
+									   featurelist);
 						
     (*feature_map)[key_gen] = generation_of_extinction;
     (*featurelist_map)[key_freq] = featurelist;
-    record_context::add_parameters_to_protobuf(feature_map, params, argv); // metadata, parameter values, etc.
+    record_context::add_parameters_to_protobuf(feature_map, params, argv, engine); // metadata, parameter values, etc.
     serialize::data(seq_example, argc, argv);
   }
 
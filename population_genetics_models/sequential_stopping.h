@@ -0,0 +1,163 @@
+/**
+   @file sequential_stopping.h
+   @brief Stops the QEF replicates once the persistence probabilities are estimated precisely enough (--precision,
+   --relative_precision)
+*/
+#ifndef SEQUENTIAL_STOPPING_H
+#define SEQUENTIAL_STOPPING_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include "include/example.pb.h"
+#include "fixed_parameters.h"
+#include "run_options.h"
+#include "thread_pool.h"
+
+/**
+   @brief Namespace for the adaptive number of QEF replicates
+   @details Two binomial proportions are estimated from the replicates: the probability that the trait persists
+   through the initial invasion (generation_of_extinction is max_generations_per_sim) and the probability that it
+   persists through all number_reinvasions reinvasion attempts (number_reinvasions_before_extinction is
+   number_reinvasions). The chunks of replicates are run in blocks of about fixed_parameters::adaptive_block_replicates
+   replicates, and after each block the 95% Wilson score interval of both proportions is calculated from all the
+   replicates so far. The replicates stop after the first block at which the half-width of both intervals is at
+   most --precision and at most --relative_precision times the estimate (whichever are given), or after
+   number_replicates_QEF replicates.
+
+   The chunks and their streams are those of the full run, and the blocks are checked in chunk order, so the
+   replicates of an adaptive run are the first replicates of the full run with the same seed (whatever the number
+   of threads). The number of replicates used and the intervals are recorded ("number_replicates",
+   "persistence_probability_interval" and "reinvasion_persistence_probability_interval", each interval being
+   [estimate, lower, upper]), as are "precision" and "relative_precision".
+*/
+namespace sequential_stopping {
+  /** @brief True if the number of replicates is adaptive (--precision or --relative_precision given) */
+  inline bool adaptive(){
+    const run_options::Run_Options &options = run_options::get();
+    return options.precision > 0.0 || options.relative_precision > 0.0;
+  }
+  /**
+     @brief Wilson score interval of a binomial proportion
+     @param[in] successes Number of successes
+     @param[in] trials Number of trials
+     @return [estimate, lower, upper]
+  */
+  inline std::array<double, 3> wilson_interval(const std::int64_t successes, const std::int64_t trials){
+    if (trials == 0){
+      return {0.0, 0.0, 1.0};
+    }
+    const double z = fixed_parameters::adaptive_confidence_z;
+    const double n = static_cast<double>(trials);
+    const double p = successes / n;
+    const double centre = (p + z * z / (2.0 * n)) / (1.0 + z * z / n);
+    const double half_width = z / (1.0 + z * z / n) * std::sqrt(p * (1.0 - p) / n + z * z / (4.0 * n * n));
+    return {p, std::max(0.0, centre - half_width), std::min(1.0, centre + half_width)};
+  }
+  /** @brief True if the half-width of \p interval meets the precision of the run options */
+  inline bool precise(const std::array<double, 3> &interval){
+    const run_options::Run_Options &options = run_options::get();
+    const double half_width = 0.5 * (interval[2] - interval[1]);
+    return (options.precision <= 0.0 || half_width <= options.precision) &&
+      (options.relative_precision <= 0.0 || half_width <= options.relative_precision * interval[0]);
+  }
+  /**
+     @brief Running counts of the replicates that persist
+  */
+  class Monitor {
+  public:
+    template <class P>
+    explicit Monitor(const P &params) : max_gen(params.fixed.max_generations_per_sim),
+					number_reinvasions(params.shared.number_reinvasions) {}
+    /** @brief Adds the replicates whose records start at \p gen_extinct and \p reinvasion_number */
+    void add(const std::int64_t* gen_extinct, const std::int64_t* reinvasion_number, const int number_replicates){
+      for (int i = 0; i < number_replicates; i++){
+	persisted += gen_extinct[i] == max_gen;
+	persisted_reinvasions += reinvasion_number[i] == number_reinvasions;
+      }
+      replicates += number_replicates;
+    }
+    /** @brief Intervals of the probabilities of persisting through the initial invasion and all reinvasions */
+    std::array<std::array<double, 3>, 2> intervals() const {
+      return {wilson_interval(persisted, replicates), wilson_interval(persisted_reinvasions, replicates)};
+    }
+    /** @brief True if both persistence probabilities are precise enough to stop */
+    bool done() const {
+      const std::array<std::array<double, 3>, 2> current = intervals();
+      return precise(current[0]) && precise(current[1]);
+    }
+
+  private:
+    std::int64_t max_gen;
+    std::int64_t number_reinvasions;
+    std::int64_t replicates = 0;
+    std::int64_t persisted = 0;
+    std::int64_t persisted_reinvasions = 0;
+  };
+  /**
+     @brief Runs run_chunk(c) for the chunks c of a QEF run on the thread pool, in blocks if the number of
+     replicates is adaptive
+     @param[in] chunks Number of chunks of the full run
+     @param[in] chunk_replicates Number of replicates per chunk
+     @param[in] run_chunk Runs one chunk
+     @param[in] add_chunk add_chunk(c, monitor) adds the records of chunk c (once it has run) to the monitor
+     @return Number of chunks run (the first ones)
+  */
+  template <class P, class F, class G>
+  int run_chunks(const P &params, const int chunks, const int chunk_replicates, F run_chunk, G add_chunk){
+    if (!adaptive()){
+      thread_pool::get_pool().parallel_for(chunks, run_chunk);
+      return chunks;
+    }
+    const int block = std::max(1, fixed_parameters::adaptive_block_replicates / chunk_replicates);
+    Monitor monitor(params);
+    for (int first = 0; first < chunks; first += block){
+      const int last = std::min(first + block, chunks);
+      thread_pool::get_pool().parallel_for(last - first, [&](int i){
+	run_chunk(first + i);
+      });
+      for (int chunk = first; chunk < last; chunk++){
+	add_chunk(chunk, monitor);
+      }
+      if (monitor.done()){
+	return last;
+      }
+    }
+    return chunks;
+  }
+  /**
+     @brief Records the number of replicates and the intervals of the persistence probabilities (adaptive runs)
+  */
+  template <class P>
+  void record(google::protobuf::Map<std::string, tensorflow::Feature>* feature_map,
+	      const tensorflow::Int64List &gen_extinct, const tensorflow::Int64List &reinvasion_number, const P &params){
+    Monitor monitor(params);
+    monitor.add(gen_extinct.value().data(), reinvasion_number.value().data(), gen_extinct.value_size());
+    tensorflow::Feature number_replicates = tensorflow::Feature();
+    number_replicates.mutable_int64_list()->add_value(gen_extinct.value_size());
+    (*feature_map)["number_replicates"] = number_replicates;
+
+    const std::array<std::array<double, 3>, 2> intervals = monitor.intervals();
+    tensorflow::Feature persistence = tensorflow::Feature();
+    tensorflow::Feature reinvasion_persistence = tensorflow::Feature();
+    for (int i = 0; i < 3; i++){
+      persistence.mutable_float_list()->add_value(intervals[0][i]);
+      reinvasion_persistence.mutable_float_list()->add_value(intervals[1][i]);
+    }
+    (*feature_map)["persistence_probability_interval"] = persistence;
+    (*feature_map)["reinvasion_persistence_probability_interval"] = reinvasion_persistence;
+
+    const run_options::Run_Options &options = run_options::get();
+    tensorflow::Feature precision = tensorflow::Feature();
+    precision.mutable_float_list()->add_value(options.precision);
+    (*feature_map)["precision"] = precision;
+    tensorflow::Feature relative_precision = tensorflow::Feature();
+    relative_precision.mutable_float_list()->add_value(options.relative_precision);
+    (*feature_map)["relative_precision"] = relative_precision;
+  }
+
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "thread_pool.h"
+#include "run_options.h"
+
+namespace thread_pool {
+
+  namespace {
+    /** Number of tasks running on this thread (the depth of the jobs it starts) */
+    thread_local int running_tasks = 0;
+  }
+
+  Thread_Pool::Thread_Pool(int number_threads){
+    for (int i = 1; i < number_threads; i++){ // calling thread is the first worker
+      workers.emplace_back(&Thread_Pool::worker_loop, this);
+    }
+  }
+
+  Thread_Pool::~Thread_Pool(){
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    work_added.notify_all();
+    for (std::thread &worker : workers){
+      worker.join();
+    }
+  }
+
+  int Thread_Pool::size() const {
+    return static_cast<int>(workers.size()) + 1;
+  }
+
+  void Thread_Pool::parallel_for(int number_tasks, const std::function<void(int)> &task){
+    if (number_tasks <= 0){
+      return;
+    }
+    Job job;
+    job.task = &task;
+    job.number_tasks = number_tasks;
+    job.depth = running_tasks;
+    job.unfinished = number_tasks;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(&job);
+    }
+    work_added.notify_all();
+    changed.notify_all();
+    run_from(job, job.next_task.fetch_add(1));
+    // the remaining tasks are running on other threads: help with jobs nested at least as deeply until they finish
+    std::unique_lock<std::mutex> lock(mutex);
+    while (job.unfinished.load() > 0){
+      int index;
+      Job* other = claim(job.depth, index);
+      if (other == nullptr){
+	changed.wait(lock);
+	continue;
+      }
+      lock.unlock();
+      run_from(*other, index);
+      lock.lock();
+    }
+    jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+  }
+
+  void Thread_Pool::worker_loop(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping){
+      int index;
+      Job* job = claim(0, index);
+      if (job == nullptr){
+	work_added.wait(lock);
+	continue;
+      }
+      lock.unlock();
+      run_from(*job, index);
+      lock.lock();
+    }
+  }
+
+  Thread_Pool::Job* Thread_Pool::claim(int min_depth, int &index){
+    while (true){
+      Job* deepest = nullptr;
+      for (Job* job : jobs){ // oldest first among jobs of equal depth
+	if (job->depth >= min_depth && job->next_task.load() < job->number_tasks &&
+	    (deepest == nullptr || job->depth > deepest->depth)){
+	  deepest = job;
+	}
+      }
+      if (deepest == nullptr){
+	return nullptr;
+      }
+      // the owner and the threads running its tasks claim without the mutex, so the last task may be gone
+      index = deepest->next_task.fetch_add(1);
+      if (index < deepest->number_tasks){
+	return deepest;
+      }
+    }
+  }
+
+  void Thread_Pool::run_from(Job &job, int index){
+    const int number_tasks = job.number_tasks;
+    while (index < number_tasks){
+      ++running_tasks;
+      (*job.task)(index);
+      --running_tasks;
+      // claim the next task before finishing this one (the job cannot complete while it has an unfinished task)
+      const int next = job.next_task.fetch_add(1);
+      if (job.unfinished.fetch_sub(1) == 1){
+	std::lock_guard<std::mutex> lock(mutex);
+	changed.notify_all();
+      }
+      index = next;
+    }
+  }
+
+  Thread_Pool& get_pool(){
+    static Thread_Pool pool(run_options::get().number_threads);
+    return pool;
+  }
+
+}
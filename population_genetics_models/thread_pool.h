@@ -0,0 +1,73 @@
+/**
+   @file thread_pool.h
+   @brief A persistent pool of worker threads used to run replicates in parallel
+*/
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace thread_pool {
+  /**
+     @brief Fixed-size pool of worker threads
+     @details Workers are started once and sleep while there is no work. The calling thread also works on
+     tasks, so a pool of size 1 has no worker threads and runs everything serially.
+
+     parallel_for may be called from inside a task (e.g. a sweep runs parameter points as outer tasks, each of
+     which runs its replicate chunks as inner tasks). Every call is a job whose tasks are claimed by index by any
+     thread: idle workers take tasks from the most deeply nested job first (finishing the points already started),
+     and a thread whose own tasks are all claimed helps with jobs at least as deeply nested as its own until they
+     are done. Which thread runs a task never matters for the output, since tasks use the random number streams of
+     their index.
+  */
+  class Thread_Pool {
+  public:
+    explicit Thread_Pool(int number_threads);
+    ~Thread_Pool();
+    Thread_Pool(const Thread_Pool&) = delete;
+    Thread_Pool& operator=(const Thread_Pool&) = delete;
+    /** @brief Number of threads (including the calling thread) that work on tasks */
+    int size() const;
+    /**
+       @brief Runs task(i) for i in [0, number_tasks) and blocks until all tasks are complete
+       @details Tasks are handed out in index order but may complete in any order, so a task must only
+       write to state owned by its index.
+    */
+    void parallel_for(int number_tasks, const std::function<void(int)> &task);
+
+  private:
+    /** One call to parallel_for (lives on the stack of the calling thread until its tasks are complete) */
+    struct Job {
+      const std::function<void(int)>* task;
+      int number_tasks;
+      int depth; /**< Number of tasks running on the calling thread when it called parallel_for */
+      std::atomic<int> next_task {0};
+      std::atomic<int> unfinished;
+    };
+    void worker_loop();
+    /** @brief Claims a task of the deepest job of depth at least \p min_depth (call with the mutex held) */
+    Job* claim(int min_depth, int &index);
+    /** @brief Runs task \p index of \p job, then the job's next tasks until none is left to claim */
+    void run_from(Job &job, int index);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_added; /**< Signalled when a job is added (idle workers wait for it) */
+    std::condition_variable changed; /**< Signalled when a job is added or completed (waiting callers wait for it) */
+    std::vector<Job*> jobs; /**< Jobs that are not yet complete, in the order they were started */
+    bool stopping = false;
+  };
+  /**
+     @brief Returns the pool shared by the whole process (sized by run_options::Run_Options::number_threads)
+  */
+  Thread_Pool& get_pool();
+
+}
+
+#endif
@@ -1,19 +1,32 @@
 #ifndef TRAIT_FREQ_H
 #define TRAIT_FREQ_H
 
-#include <vector>
+#include <array>
+#include <cmath>
 #include "Parameters.h"
 
 namespace trait_freq {
+  /**
+     @brief State of a replicate: number of individuals carrying each tracked trait
+     @details Haploid state is { #A }; diploid state is { #AA, #Aa }. The size is fixed per model
+     (P::number_traits) so the state lives on the stack; frequencies are only calculated when recorded.
+  */
+  template <class P>
+  using trait_counts = std::array<int, P::number_traits>;
+  /**
+     @brief Number of individuals carrying the trait at the start of an invasion (i.e. initial_trait_freq * N)
+  */
+  template <class P>
+  int invader_count(const P &params){
+    return static_cast<int>(std::lround(params.shared.initial_trait_freq * params.shared.population_size));
+  }
   
   template <class P>
-  std::vector<double> initialise_trait_freq(const P &params){
+  trait_counts<P> initialise_trait_counts(const P &params){
     // params.model.trait_info[0] is index of trait of interest
-    // params.model.trait_info[1] is the number of traits to track
-    // haploid trait_freq is { P(A) }; diploid trait freq is { P(AA), P(Aa) }
-    std::vector<double> trait_freq(params.shared.trait_info[1]);
-    trait_freq[ params.shared.trait_info[0] ] = params.shared.initial_trait_freq;
-    return trait_freq;
+    trait_counts<P> trait_count {};
+    trait_count[ params.shared.trait_info[0] ] = invader_count(params);
+    return trait_count;
   }
 
 }
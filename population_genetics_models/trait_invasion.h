@@ -5,49 +5,94 @@
 #ifndef TRAIT_INVASION_H
 #define TRAIT_INVASION_H
 
-#include <random>
-#include <vector>
+#include "absorbing_shortcut.h"
+#include "environment_schedule.h"
+#include "quasi_stationary.h"
+#include "trait_freq.h"
 #include "conditional_existence_status.h"
 #include "include/example.pb.h"
 #include "record_data.h"
 
 namespace invasion {
+  /**
+     @brief Per-parameter-set state of the jumps of an invasion attempt (absorbing_shortcut and quasi_stationary)
+     @details Depends only on the kernel, the parameters and the run options, so it is built once per parameter set
+     (in the engine that runs the replicates) and shared by all of its attempts and threads.
+  */
+  template <class K>
+  struct Shortcuts {
+    Shortcuts(const K &kernel, const typename K::Parameters &parameters)
+      : absorbing(kernel, parameters), wells(kernel, parameters) {}
+    const absorbing_shortcut::Shortcut<K> absorbing;
+    const quasi_stationary::Wells<K> wells;
+  };
   /**
      @brief Runs a single invasion attempt of a trait
-     @param[in] fitnesses Vector containing fitnesses
+     @details Instantiated per model kernel so that the per-generation step is inlined into the loop
+     @param[in] kernel Model kernel (one of HSE::Kernel, HTE::Kernel, DSE::Kernel, or HTEOE::Kernel)
      @param[in] parameters.shared.population_size Number of individuals in the population
-     @param[in] parameters.fixed.tolerance Tolerance for comparing equality of doubles
-     @param[in, out] rng Random number generator
-     @param[in] calculate_trait_freqs Template for method to calcluate traitfrequency (one of HSE::calculate_trait_freqs, HTE::calculate_trait_freqs, DSE::calculate_trait_freqs, or HTEOE::calculate_trait_freqs)
-     @param[in] reinvasions Equals -1 when the invasion is the initial one (i.e. trait invading resident)
-     @return Nothing (but alters \p trait_freq)
+     @param[in] shortcuts Shortcuts of \p kernel and \p parameters
+     @param[in, out] rng Random number engine (one of the rng:: engines)
+     @param[in, out] trait_count Number of individuals carrying each tracked trait
+     @param[in, out] gen Current generation
+     @return Nothing (but alters \p trait_count)
+     @details With --shortcut, a haploid attempt that is almost certain to fix jumps to its outcome (see
+     absorbing_shortcut); with --quasi_stationary=on, so does an attempt that has settled at a stable polymorphism
+     (see quasi_stationary)
   */
-  template <class P, class F>
-  void trait_invasion(const std::vector<double> &fitnesses, const P &parameters, std::mt19937 &rng,
-		      std::vector<double> &trait_freq, F calculate_trait_freqs, int &gen){
-    bool allele_A_extinct, allele_A_fixed, reached_max_gen;
-    do {
-      calculate_trait_freqs(trait_freq, fitnesses, parameters, rng, gen);
-
-      allele_A_extinct = conditional_existence_status::allele_A_extinct(trait_freq, parameters);
-      allele_A_fixed = conditional_existence_status::allele_A_fixed(trait_freq, parameters);
-      reached_max_gen = conditional_existence_status::reached_max_gen(gen, parameters);
+  template <class K, class R>
+  void trait_invasion(const K &kernel, const typename K::Parameters &parameters, const Shortcuts<K> &shortcuts,
+		      R &rng, trait_freq::trait_counts<typename K::Parameters> &trait_count, int &gen){
+    quasi_stationary::Monitor<K> monitor(shortcuts.wells);
+    // checks the state after a step (jumping it if the shortcut or the quasi-stationary detection applies)
+    auto running = [&](){
+      bool allele_A_extinct = conditional_existence_status::allele_A_extinct(trait_count, parameters);
+      bool allele_A_fixed = conditional_existence_status::allele_A_fixed(trait_count, parameters);
+      bool reached_max_gen = conditional_existence_status::reached_max_gen(gen, parameters);
+      if (!allele_A_extinct && !allele_A_fixed && !reached_max_gen &&
+	  (shortcuts.absorbing.absorb(kernel, trait_count[0], gen) ||
+	   monitor.resolve(kernel, parameters, rng, trait_count, gen))){
+	allele_A_extinct = conditional_existence_status::allele_A_extinct(trait_count, parameters);
+	allele_A_fixed = conditional_existence_status::allele_A_fixed(trait_count, parameters);
+	reached_max_gen = conditional_existence_status::reached_max_gen(gen, parameters);
+      }
+      return !allele_A_extinct && !allele_A_fixed && !reached_max_gen;
+    };
+    if constexpr (environment_schedule::has_schedule<K>::value){
+      // one segment (run of generations in one environment) at a time (see environment_schedule)
+      environment_schedule::Cursor cursor(kernel.schedule);
+      bool still_running = true;
+      while (still_running){
+	const environment_schedule::Segment segment = cursor.next(gen, rng);
+	do {
+	  kernel.step_in_environment(trait_count, rng, segment.environment);
+	  ++gen;
+	  still_running = running();
+	}
+	while (still_running && gen < segment.end);
+      }
+    } else {
+      do {
+	kernel.step(trait_count, rng, gen);
+	++gen;
+      }
+      while (running());
     }
-    while ( !allele_A_extinct && !allele_A_fixed && !reached_max_gen );
   }
   // overloaded method for LSTM scenario
-  template <class P, class F>
-  void trait_invasion(const std::vector<double> &fitnesses, const P &parameters, std::mt19937 &rng,
-		      std::vector<double> &trait_freq, F calculate_trait_freqs, int &gen,
+  template <class K, class R>
+  void trait_invasion(const K &kernel, const typename K::Parameters &parameters, R &rng,
+		      trait_freq::trait_counts<typename K::Parameters> &trait_count, int &gen,
 		      tensorflow::FloatList* raw_trait_freq){
     bool allele_A_extinct, allele_A_fixed, reached_max_gen;
-    record_data::raw_trait_freq(raw_trait_freq, trait_freq); // record initial freqs
+    record_data::raw_trait_freq(raw_trait_freq, trait_count, parameters.shared.population_size); // record initial freqs
     do {
-      calculate_trait_freqs(trait_freq, fitnesses, parameters, rng, gen);
-      record_data::raw_trait_freq(raw_trait_freq, trait_freq);
+      kernel.step(trait_count, rng, gen);
+      ++gen;
+      record_data::raw_trait_freq(raw_trait_freq, trait_count, parameters.shared.population_size);
     
-      allele_A_extinct = conditional_existence_status::allele_A_extinct(trait_freq, parameters);
-      allele_A_fixed = conditional_existence_status::allele_A_fixed(trait_freq, parameters);
+      allele_A_extinct = conditional_existence_status::allele_A_extinct(trait_count, parameters);
+      allele_A_fixed = conditional_existence_status::allele_A_fixed(trait_count, parameters);
       reached_max_gen = conditional_existence_status::reached_max_gen(gen, parameters);
     }
     while ( !allele_A_extinct && !allele_A_fixed && !reached_max_gen );